@@ -0,0 +1,86 @@
+// Per-request overhead of `invoke` against the ensureSlots, setSlot*,
+// protectedCall and getSlot* sequence it replaces, on a program of yours:
+//
+//   node bench/invoke.js CHUNK MODULE:PROGRAM RETURNINGS [USING...]
+//
+// RETURNINGS has a letter per returning: n for Comp2, c for Comp4, d for
+// Display. Numeric usings are passed as Comp2, others as Display. Runs
+// against the build in lib/, ITERATIONS sets the requests per variant.
+const { Cam, SlotType, ErrorCode, packValues } = require('..')
+
+const [chunk, entry, returnings = '', ...args] = process.argv.slice(2)
+if (!chunk || !entry || entry.indexOf(':') < 0) {
+        console.error('usage: node bench/invoke.js CHUNK MODULE:PROGRAM RETURNINGS [USING...]')
+        process.exit(2)
+}
+
+const program = entry.split(':')
+const usings = args.map(a => /^-?\d+(\.\d+)?$/.test(a) ? Number(a) : a)
+const types = [...returnings].map(r => ({ n: SlotType.Comp2, c: SlotType.Comp4, d: SlotType.Display })[r])
+const iterations = Number(process.env.ITERATIONS) || 100000
+
+const cam = new Cam()
+let ec = cam.addChunk(chunk)
+if (ec === ErrorCode.Success) {
+        ec = cam.link()
+}
+if (ec !== ErrorCode.Success) {
+        console.error('failed to load ' + chunk + ': code = ' + ec)
+        process.exit(1)
+}
+
+function sequence()
+{
+        cam.ensureSlots(1 + Math.max(usings.length, types.length))
+        cam.setSlotProgram(0, program[0], program[1])
+        for (let i = 0; i < usings.length; ++i) {
+                if (typeof usings[i] === 'number') {
+                        cam.setSlotComp2(1 + i, usings[i])
+                } else {
+                        cam.setSlotDisplay(1 + i, usings[i])
+                }
+        }
+        const ec = cam.protectedCall(usings.length, types.length)
+        const out = []
+        for (let i = 0; i < types.length; ++i) {
+                switch (types[i]) {
+                case SlotType.Comp2:
+                        out.push(cam.getSlotComp2(i))
+                        break
+                case SlotType.Comp4:
+                        out.push(cam.getSlotComp4(i))
+                        break
+                default:
+                        out.push(cam.getSlotDisplay(i))
+                        break
+                }
+        }
+        return ec
+}
+
+const packed = packValues(usings)
+const variants = {
+        'sequence':                sequence,
+        'invoke':                  () => cam.invoke(program, usings, types).errorCode,
+        'invoke, packed usings':   () => cam.invoke(program, packed, types).errorCode,
+        'invoke, packed both':     () => cam.invoke(program, packed, types, true).errorCode
+}
+
+for (const name of Object.keys(variants)) {
+        const run = variants[name]
+        // warm up the JIT and the program's working storage
+        for (let i = 0; i < Math.min(iterations, 10000); ++i) {
+                run()
+        }
+
+        const started = process.hrtime.bigint()
+        for (let i = 0; i < iterations; ++i) {
+                const ec = run()
+                if (ec !== ErrorCode.Success) {
+                        console.error(name + ' failed: code = ' + ec)
+                        process.exit(1)
+                }
+        }
+        const ns = Number(process.hrtime.bigint() - started) / iterations
+        console.log(name.padEnd(24) + (ns / 1000).toFixed(3) + ' us/request')
+}
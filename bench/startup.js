@@ -0,0 +1,59 @@
+// Wall time from launch to exit of cam-run against the same run through
+// the Node wrapper, on a program of yours:
+//
+//   node bench/startup.js MODULE:PROGRAM CHUNK... [-- ARG...]
+//
+// Both load the chunks, register the native programs and call the program
+// with the arguments, decimal ones as Comp2 and others as Display. The
+// program's output is discarded. Runs the build in build/Release and lib/,
+// RUNS sets the launches per variant and the median is printed.
+const { spawnSync } = require('child_process')
+const path = require('path')
+
+const argv = process.argv.slice(2)
+const sep = argv.indexOf('--')
+const [entry, ...chunks] = sep < 0 ? argv : argv.slice(0, sep)
+const args = sep < 0 ? [] : argv.slice(sep + 1)
+if (!entry || entry.indexOf(':') < 0 || chunks.length === 0) {
+        console.error('usage: node bench/startup.js MODULE:PROGRAM CHUNK... [-- ARG...]')
+        process.exit(2)
+}
+
+const root = path.resolve(__dirname, '..')
+const runs = Number(process.env.RUNS) || 20
+
+const wrapper = `
+const { Cam, ErrorCode } = require(${JSON.stringify(root)})
+const [entry, chunks, args] = JSON.parse(process.argv[1])
+const cam = new Cam({ nativePrograms: true })
+for (const chunk of chunks) {
+        const ec = cam.addChunk(chunk)
+        if (ec !== ErrorCode.Success) {
+                process.exit(1)
+        }
+}
+const usings = args.map(a => /^-?(\\d+\\.?\\d*|\\.\\d+)$/.test(a) ? Number(a) : a)
+process.exit(cam.invoke(entry.split(':'), usings, []).errorCode === ErrorCode.Success ? 0 : 1)
+`
+
+const variants = {
+        'cam-run': [path.join(root, 'build', 'Release', 'cam-run'), ['-e', entry, ...chunks, '--', ...args]],
+        'node':    [process.execPath, ['-e', wrapper, JSON.stringify([entry, chunks, args])]]
+}
+
+for (const name of Object.keys(variants)) {
+        const [file, fileArgs] = variants[name]
+        const times = []
+        for (let i = 0; i < runs; ++i) {
+                const started = process.hrtime.bigint()
+                const r = spawnSync(file, fileArgs, { stdio: ['ignore', 'ignore', 'inherit'] })
+                const ms = Number(process.hrtime.bigint() - started) / 1e6
+                if (r.error || r.status !== 0) {
+                        console.error(name + ' failed: ' + (r.error ? r.error.message : 'status = ' + r.status))
+                        process.exit(1)
+                }
+                times.push(ms)
+        }
+        times.sort((a, b) => a - b)
+        console.log(name.padEnd(10) + times[times.length >> 1].toFixed(1) + ' ms')
+}
@@ -7,12 +7,51 @@
                                 "<!@(node -p \"require('fs').readdirSync('vendor/cam/src/lib/').filter(f => f.endsWith('.c')).map(f => 'vendor/cam/src/lib/' + f).join(' ')\")",
                                 "src/cam_native.cc",
                                 "src/assembler_native.cc",
-                                "src/init_modules.cc"
+                                "src/comp3.cc",
+                                "src/comp4_native.cc",
+                                "src/record_native.cc",
+                                "src/sort.cc",
+                                "src/init_modules.cc",
+                                "src/native_common.cc"
                         ],
                         "include_dirs": [
                                 "<!(node -e \"require('nan')\")",
                                 "vendor/cam/include"
+                        ],
+                        "conditions": [
+                                ["OS!=\"win\"", {
+                                        "sources": [
+                                                "src/indexed_file.cc",
+                                                "src/sequential_file.cc"
+                                        ],
+                                        "defines": [
+                                                "CAM_NATIVE_FILES"
+                                        ]
+                                }]
                         ]
                 }
+        ],
+        "conditions": [
+                ["OS!=\"win\"", {
+                        "targets": [
+                                {
+                                        "target_name": "cam-run",
+                                        "type": "executable",
+                                        "sources": [
+                                                "<!@(node -p \"require('fs').readdirSync('vendor/cam/src/').filter(f => f.endsWith('.c')).map(f => 'vendor/cam/src/' + f).join(' ')\")",
+                                                "<!@(node -p \"require('fs').readdirSync('vendor/cam/src/lib/').filter(f => f.endsWith('.c')).map(f => 'vendor/cam/src/lib/' + f).join(' ')\")",
+                                                "src/cam_run.cc",
+                                                "src/comp3.cc",
+                                                "src/sort.cc",
+                                                "src/indexed_file.cc",
+                                                "src/sequential_file.cc",
+                                                "src/native_common.cc"
+                                        ],
+                                        "include_dirs": [
+                                                "vendor/cam/include"
+                                        ]
+                                }
+                        ]
+                }]
         ]
 }
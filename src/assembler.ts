@@ -1,6 +1,8 @@
 const native = require('bindings')('cam-native')
 import { v4 as uuidv4 } from 'uuid'
 import { Comp4 } from './cam'
+import { ChunkManifest, ProgramRef, manifestPath } from './bundle'
+import { writeFileSync } from 'fs'
 
 export enum Opcode
 {
@@ -27,6 +29,7 @@ export interface AssemblerNative
         serialize(path: string): void
         wfieldComp2(value: number): number
         wfieldComp4(comp4: Comp4): number
+        wfieldComp3(packed: Buffer, scale: number): number
         wfieldDisplay(value?: string): number
         import(module: string, program: string): number
         emitA(opcode: Opcode): number
@@ -42,10 +45,60 @@ export var AssemblerNative: {
 
 export class Assembler extends AssemblerNative
 {
+        private module: string
+        private programs: string[] = []
+        private imports: ProgramRef[] = []
+
         constructor(module: string)
         {
                 const uuid = Buffer.alloc(16)
                 uuidv4(null, uuid, 0)
                 super(module, uuid)
+                this.module = module
+        }
+
+        // The named prototypes this chunk provides and the programs it
+        // imports, as used by `BundleWriter`.
+        manifest(): ChunkManifest
+        {
+                return {
+                        module: this.module,
+                        programs: this.programs.slice(),
+                        imports: this.imports.slice()
+                }
+        }
+
+        // Also writes the manifest next to the chunk, for `BundleWriter`.
+        serialize(path: string): void
+        {
+                super.serialize(path)
+                writeFileSync(manifestPath(path), JSON.stringify(this.manifest()))
+        }
+
+        wfieldComp3(packed: Buffer, scale: number): number
+        {
+                const idx = super.wfieldComp3(packed, scale)
+                if (idx === -1) {
+                        throw new RangeError('bad packed decimal')
+                }
+                return idx
+        }
+
+        import(module: string, program: string): number
+        {
+                const idx = super.import(module, program)
+                if (idx >= this.imports.length) {
+                        this.imports.push({ module, program })
+                }
+                return idx
+        }
+
+        prototypePush(name?: string): number
+        {
+                const idx = super.prototypePush(name)
+                if (name !== undefined) {
+                        this.programs.push(name)
+                }
+                return idx
         }
 }
@@ -1,3 +1,4 @@
+#include "native_common.h"
 #include <cam/assembler.h>
 #include <cam/memory.h>
 
@@ -181,6 +182,45 @@ private:
                 return ret;
         }
 
+        static napi_value WfieldComp3(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 2;
+                napi_value jsthis, argv[2];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 2);
+
+                Assembler *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                uint8_t *packed;
+                size_t packed_len;
+                status = napi_get_buffer_info(env, argv[0], (void**)&packed, &packed_len);
+                assert(status == napi_ok);
+
+                int scale;
+                status = napi_get_value_int32(env, argv[1], &scale);
+                assert(status == napi_ok);
+                if (scale < 0 || scale > 18) {
+                        napi_throw_range_error(env, nullptr, "scale must be within 0 and 18");
+                        return nullptr;
+                }
+
+                bool is_signed;
+                cam_comp_4_t value;
+                int idx = -1;
+                if (packed_len <= 10 && comp3_unpack(packed, (int)packed_len, &is_signed, &value)) {
+                        idx = cam_asm_wfield_comp_4(obj->_as, is_signed, scale, value);
+                }
+
+                napi_value ret;
+                status = napi_create_int32(env, idx, &ret);
+                assert(status == napi_ok);
+                return ret;
+        }
+
         static napi_value WfieldDisplay(napi_env env, napi_callback_info info)
         {
                 napi_status status;
@@ -399,6 +439,7 @@ public:
                         DECLARE_NAPI_METHOD("serialize",     &Serialize),
                         DECLARE_NAPI_METHOD("wfieldComp2",   &WfieldComp2),
                         DECLARE_NAPI_METHOD("wfieldComp4",   &WfieldComp4),
+                        DECLARE_NAPI_METHOD("wfieldComp3",   &WfieldComp3),
                         DECLARE_NAPI_METHOD("wfieldDisplay", &WfieldDisplay),
                         DECLARE_NAPI_METHOD("import",        &Import),
                         DECLARE_NAPI_METHOD("emitA",         &EmitA),
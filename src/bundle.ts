@@ -0,0 +1,313 @@
+import { readFileSync, writeFileSync } from 'fs'
+
+export interface ProgramRef
+{
+        module: string
+        program: string
+}
+
+// What a chunk provides and needs, see `Assembler.manifest`. Chunks carry
+// no such table themselves, so only chunks built by `Assembler` have one:
+// in process, or next to the chunk file its `serialize` wrote.
+export interface ChunkManifest
+{
+        module: string
+        programs: string[]
+        imports: ProgramRef[]
+}
+
+export function manifestPath(chunkPath: string): string
+{
+        return chunkPath + '.manifest.json'
+}
+
+export function readManifest(chunkPath: string): ChunkManifest
+{
+        return JSON.parse(readFileSync(manifestPath(chunkPath), 'utf8'))
+}
+
+export interface BundleStats
+{
+        chunks: number
+        droppedChunks: number
+        programs: number
+        bytes: number
+}
+
+// Layout, all integers little endian u32:
+//   header     magic, version, number of chunks, number of programs
+//   chunks     offset and size of each chunk, then offset and count of
+//              its dependencies
+//   directory  name offset, name length and chunk of each program, sorted
+//              by name, a name being `module` NUL `program`
+//   names
+//   deps       the chunks providing each chunk's imports
+//   data       chunks, each aligned to `ALIGN`
+const MAGIC = 0x424d4143 // "CAMB"
+const VERSION = 2
+const HEADER_SIZE = 16
+const CHUNK_ENTRY_SIZE = 16
+const DIRECTORY_ENTRY_SIZE = 12
+const ALIGN = 8
+
+function programName(module: string, program: string): Buffer
+{
+        return Buffer.from(module + '\0' + program)
+}
+
+function align(n: number): number
+{
+        return (n + ALIGN - 1) & ~(ALIGN - 1)
+}
+
+// Merges chunks into a single bundle, keeping only the chunks reachable
+// from the entry programs through their imports.
+export class BundleWriter
+{
+        private chunks: { chunk: Buffer, manifest: ChunkManifest }[] = []
+
+        // A chunk file's manifest defaults to the one `Assembler.serialize`
+        // wrote next to it.
+        add(chunk: Buffer | string, manifest?: ChunkManifest): void
+        {
+                if (manifest === undefined) {
+                        if (typeof chunk !== 'string') {
+                                throw new Error('a chunk buffer needs its manifest')
+                        }
+                        manifest = readManifest(chunk)
+                }
+                this.chunks.push({
+                        chunk: typeof chunk === 'string' ? readFileSync(chunk) : chunk,
+                        manifest
+                })
+        }
+
+        write(path: string, roots: ProgramRef[]): BundleStats
+        {
+                const providers = new Map<string, number>()
+                this.chunks.forEach(({ manifest }, i) => {
+                        for (const program of manifest.programs) {
+                                const name = programName(manifest.module, program).toString('latin1')
+                                if (providers.has(name)) {
+                                        throw new Error('duplicate program ' + manifest.module + ':' + program)
+                                }
+                                providers.set(name, i)
+                        }
+                })
+
+                // imports without a provider are foreign programs, e.g. SYSTEM
+                const reachable = new Set<number>()
+                const pending: number[] = []
+                const visit = (ref: ProgramRef) => {
+                        const i = providers.get(programName(ref.module, ref.program).toString('latin1'))
+                        if (i !== undefined && !reachable.has(i)) {
+                                reachable.add(i)
+                                pending.push(i)
+                        }
+                }
+                for (const root of roots) {
+                        if (!providers.has(programName(root.module, root.program).toString('latin1'))) {
+                                throw new Error('entry program not found ' + root.module + ':' + root.program)
+                        }
+                        visit(root)
+                }
+                while (pending.length > 0) {
+                        this.chunks[pending.pop()!].manifest.imports.forEach(visit)
+                }
+
+                // keep the original order, chunks are added in it
+                const kept = [...reachable].sort((a, b) => a - b)
+                const index = new Map<number, number>(kept.map((c, i): [number, number] => [c, i]))
+
+                const directory: { name: Buffer, chunk: number }[] = []
+                for (const c of kept) {
+                        const { module, programs } = this.chunks[c].manifest
+                        for (const program of programs) {
+                                directory.push({ name: programName(module, program), chunk: index.get(c)! })
+                        }
+                }
+                directory.sort((a, b) => Buffer.compare(a.name, b.name))
+
+                const deps = kept.map((c) => {
+                        const found = new Set<number>()
+                        for (const ref of this.chunks[c].manifest.imports) {
+                                const i = providers.get(programName(ref.module, ref.program).toString('latin1'))
+                                if (i !== undefined && i !== c) {
+                                        found.add(index.get(i)!)
+                                }
+                        }
+                        return [...found].sort((a, b) => a - b)
+                })
+
+                const namesOffset = HEADER_SIZE + kept.length * CHUNK_ENTRY_SIZE + directory.length * DIRECTORY_ENTRY_SIZE
+                const namesSize = directory.reduce((n, e) => n + e.name.length, 0)
+                const depsOffset = namesOffset + namesSize
+                const depsCount = deps.reduce((n, d) => n + d.length, 0)
+                let size = align(depsOffset + depsCount * 4)
+                const offsets = kept.map((c) => {
+                        const offset = size
+                        size = align(size + this.chunks[c].chunk.length)
+                        return offset
+                })
+
+                const out = Buffer.alloc(size)
+                out.writeUInt32LE(MAGIC, 0)
+                out.writeUInt32LE(VERSION, 4)
+                out.writeUInt32LE(kept.length, 8)
+                out.writeUInt32LE(directory.length, 12)
+
+                let depOffset = depsOffset
+                kept.forEach((c, i) => {
+                        const chunk = this.chunks[c].chunk
+                        const at = HEADER_SIZE + i * CHUNK_ENTRY_SIZE
+                        out.writeUInt32LE(offsets[i], at)
+                        out.writeUInt32LE(chunk.length, at + 4)
+                        out.writeUInt32LE(depOffset, at + 8)
+                        out.writeUInt32LE(deps[i].length, at + 12)
+                        chunk.copy(out, offsets[i])
+                        for (const d of deps[i]) {
+                                out.writeUInt32LE(d, depOffset)
+                                depOffset += 4
+                        }
+                })
+
+                let nameOffset = namesOffset
+                directory.forEach((e, i) => {
+                        const at = HEADER_SIZE + kept.length * CHUNK_ENTRY_SIZE + i * DIRECTORY_ENTRY_SIZE
+                        out.writeUInt32LE(nameOffset, at)
+                        out.writeUInt32LE(e.name.length, at + 4)
+                        out.writeUInt32LE(e.chunk, at + 8)
+                        e.name.copy(out, nameOffset)
+                        nameOffset += e.name.length
+                })
+
+                writeFileSync(path, out)
+
+                return {
+                        chunks: kept.length,
+                        droppedChunks: this.chunks.length - kept.length,
+                        programs: directory.length,
+                        bytes: size
+                }
+        }
+}
+
+// A bundle read with a single file open, chunks are views into it. Every
+// table entry is checked against the buffer when it's opened, so that the
+// accessors can't read past it.
+export class Bundle
+{
+        readonly buffer: Buffer
+        readonly numChunks: number
+        readonly numPrograms: number
+
+        constructor(buffer: Buffer)
+        {
+                if (buffer.length < HEADER_SIZE || buffer.readUInt32LE(0) !== MAGIC) {
+                        throw new Error('not a bundle')
+                }
+                if (buffer.readUInt32LE(4) !== VERSION) {
+                        throw new Error('unsupported bundle version ' + buffer.readUInt32LE(4))
+                }
+                this.buffer = buffer
+                this.numChunks = buffer.readUInt32LE(8)
+                this.numPrograms = buffer.readUInt32LE(12)
+
+                const directory = HEADER_SIZE + this.numChunks * CHUNK_ENTRY_SIZE
+                if (directory + this.numPrograms * DIRECTORY_ENTRY_SIZE > buffer.length) {
+                        throw new Error('truncated bundle')
+                }
+                const inside = (offset: number, size: number) => offset + size <= buffer.length
+                for (let i = 0; i < this.numChunks; ++i) {
+                        const at = HEADER_SIZE + i * CHUNK_ENTRY_SIZE
+                        const depsOffset = buffer.readUInt32LE(at + 8)
+                        const depsCount = buffer.readUInt32LE(at + 12)
+                        if (!inside(buffer.readUInt32LE(at), buffer.readUInt32LE(at + 4)) || !inside(depsOffset, depsCount * 4)) {
+                                throw new Error('bad bundle chunk entry ' + i)
+                        }
+                        for (let d = 0; d < depsCount; ++d) {
+                                if (buffer.readUInt32LE(depsOffset + d * 4) >= this.numChunks) {
+                                        throw new Error('bad bundle chunk entry ' + i)
+                                }
+                        }
+                }
+                for (let i = 0; i < this.numPrograms; ++i) {
+                        const at = directory + i * DIRECTORY_ENTRY_SIZE
+                        if (!inside(buffer.readUInt32LE(at), buffer.readUInt32LE(at + 4))
+                         || buffer.readUInt32LE(at + 8) >= this.numChunks) {
+                                throw new Error('bad bundle directory entry ' + i)
+                        }
+                }
+        }
+
+        static open(path: string): Bundle
+        {
+                return new Bundle(readFileSync(path))
+        }
+
+        chunk(i: number): Buffer
+        {
+                const at = HEADER_SIZE + i * CHUNK_ENTRY_SIZE
+                const offset = this.buffer.readUInt32LE(at)
+                return this.buffer.subarray(offset, offset + this.buffer.readUInt32LE(at + 4))
+        }
+
+        // Index of the chunk providing the program, binary search over the
+        // directory.
+        find(module: string, program: string): number | undefined
+        {
+                const name = programName(module, program)
+                const directory = HEADER_SIZE + this.numChunks * CHUNK_ENTRY_SIZE
+
+                let lo = 0
+                let hi = this.numPrograms
+                while (lo < hi) {
+                        const mid = (lo + hi) >>> 1
+                        const at = directory + mid * DIRECTORY_ENTRY_SIZE
+                        const offset = this.buffer.readUInt32LE(at)
+                        const length = this.buffer.readUInt32LE(at + 4)
+                        const cmp = Buffer.compare(this.buffer.subarray(offset, offset + length), name)
+                        if (cmp === 0) {
+                                return this.buffer.readUInt32LE(at + 8)
+                        }
+                        if (cmp < 0) {
+                                lo = mid + 1
+                        } else {
+                                hi = mid
+                        }
+                }
+                return undefined
+        }
+
+        // The chunks providing `roots` and everything they import, in bundle
+        // order.
+        chunksFor(roots: ProgramRef[]): number[]
+        {
+                const needed = new Set<number>()
+                const pending: number[] = []
+                const need = (c: number) => {
+                        if (!needed.has(c)) {
+                                needed.add(c)
+                                pending.push(c)
+                        }
+                }
+
+                for (const root of roots) {
+                        const c = this.find(root.module, root.program)
+                        if (c === undefined) {
+                                throw new Error('program not in bundle ' + root.module + ':' + root.program)
+                        }
+                        need(c)
+                }
+                while (pending.length > 0) {
+                        const at = HEADER_SIZE + pending.pop()! * CHUNK_ENTRY_SIZE
+                        const depsOffset = this.buffer.readUInt32LE(at + 8)
+                        const depsCount = this.buffer.readUInt32LE(at + 12)
+                        for (let d = 0; d < depsCount; ++d) {
+                                need(this.buffer.readUInt32LE(depsOffset + d * 4))
+                        }
+                }
+
+                return [...needed].sort((a, b) => a - b)
+        }
+}
@@ -1,5 +1,8 @@
 const native = require('bindings')('cam-native')
 import { ErrorCode } from './error'
+import { Bundle, ProgramRef } from './bundle'
+import { RecordCodecNative } from './record'
+import { RecordTransform, RecordTransformOptions } from './stream'
 import { readFileSync } from 'fs'
 
 export interface Foreign
@@ -30,35 +33,236 @@ export class Comp4
         }
 }
 
+export type Using = number | string | Comp4 | undefined
+
+export interface InvokeResult
+{
+        errorCode: ErrorCode
+        returnings: (number | string | Comp4 | undefined)[]
+}
+
+export interface PackedInvokeResult
+{
+        errorCode: ErrorCode
+        // see `packValues`
+        returnings: Buffer
+}
+
+// Packs `values` the way `invoke` takes usings: per value a SlotType byte
+// followed by a Comp2's float64, a Comp4's sign byte, int32 scale and
+// int64, or a Display's int32 length and UTF-8 bytes, in host byte order.
+// `undefined` is an Unknown, passed as an empty Display.
+export function packValues(values: Using[]): Buffer
+{
+        const parts: Buffer[] = []
+        for (const v of values) {
+                if (typeof v === 'number') {
+                        parts.push(Buffer.from([SlotType.Comp2]), Buffer.from(new Float64Array([v]).buffer))
+                } else if (typeof v === 'string') {
+                        const bytes = Buffer.from(v)
+                        parts.push(Buffer.from([SlotType.Display]), Buffer.from(new Int32Array([bytes.length]).buffer), bytes)
+                } else if (v === undefined) {
+                        parts.push(Buffer.from([SlotType.Unknown]))
+                } else {
+                        parts.push(
+                                Buffer.from([SlotType.Comp4, v.isSigned ? 1 : 0]),
+                                Buffer.from(new Int32Array([v.scale]).buffer),
+                                Buffer.from(new BigInt64Array([v.value as bigint]).buffer))
+                }
+        }
+        return Buffer.concat(parts)
+}
+
+// Reverses `packValues`, Unknown and Program values yield `undefined`.
+export function unpackValues(buf: Buffer): Using[]
+{
+        const values: Using[] = []
+        let i = 0
+        const take = (n: number): ArrayBuffer => {
+                const bytes = new Uint8Array(n)
+                buf.copy(bytes, 0, i, i + n)
+                i += n
+                return bytes.buffer
+        }
+        while (i < buf.length) {
+                switch (buf[i++]) {
+                case SlotType.Comp2:
+                        values.push(new Float64Array(take(8))[0])
+                        break
+                case SlotType.Comp4: {
+                        const isSigned = buf[i++] !== 0
+                        const scale = new Int32Array(take(4))[0]
+                        values.push(new Comp4(isSigned, scale, new BigInt64Array(take(8))[0]))
+                        break }
+                case SlotType.Display: {
+                        const length = new Int32Array(take(4))[0]
+                        values.push(buf.toString('utf8', i, i + length))
+                        i += length
+                        break }
+                default:
+                        values.push(undefined)
+                        break
+                }
+        }
+        return values
+}
+
+export interface RunRecordsResult
+{
+        errorCode: ErrorCode
+        processed: number
+        output: Buffer
+}
+
+export interface ResultCacheStats
+{
+        hits: number
+        misses: number
+        // calls not cached because a using can't be keyed or a returning
+        // can't be replayed, e.g. a program
+        uncacheable: number
+        entries: number
+        bytes: number
+}
+
+export interface ChunkLoad
+{
+        path: string
+        errorCode: ErrorCode
+        // set for I/O failures
+        error?: string
+        // whether the chunk is in the instance, see `addChunksAsync`
+        added: boolean
+        bytes: number
+        readMs: number
+        addMs: number
+}
+
+export interface ChunksLoadResult
+{
+        // `Success` if every chunk was added, the promise rejects otherwise
+        errorCode: ErrorCode
+        elapsedMs: number
+        chunks: ChunkLoad[]
+}
+
 export interface CamNative
 {
         addChunkBuffer(buf: Buffer): ErrorCode
+        // Reads the files off the main thread and adds them in order. On a
+        // failure the promise rejects with an Error whose `result` is the
+        // ChunksLoadResult: nothing is added if a read failed, but an add
+        // that fails leaves the chunks before it added.
+        addChunksAsync(paths: string[]): Promise<ChunksLoadResult>
         addForeign(module: string, program: string, foreign: Foreign): void
         link(): ErrorCode
+        // Defers linking to the next program lookup after chunks or
+        // foreign programs were added, which then links everything once.
+        setLazyLink(enabled: boolean): void
         ensureSlots(numSlots: number): void
         numSlots(): number
         slotType(slot: number): SlotType
         setSlotComp2(slot: number, value: number): void
         setSlotComp4(slot: number, value: Comp4): void
-        setSlotProgram(slot: number, module: string, program: string): void
+        // Throws a RangeError for a bad packed decimal, one longer than 10
+        // bytes, or a scale outside 0..18.
+        setSlotComp3(slot: number, packed: Buffer, scale: number): void
+        setSlotProgram(slot: number, module: string, program: string): ErrorCode
         setSlotDisplay(slot: number, value?: string): void
         getSlotComp2(slot: number): number
         getSlotComp4(slot: number): Comp4
+        // Throws a RangeError rather than drop digits, high ones or fraction
+        // digits below `scale`, and a TypeError if the slot isn't a Comp4.
+        getSlotComp3(slot: number, length: number, scale: number): Buffer
         getSlotDisplay(slot: number): string
         slotCopy(dstSlot: number, srcSlot: number): void
         call(numUsings: number, numReturnings: number): void
-        protectedCall(numUsings: number, numReturnings: number): void
+        protectedCall(numUsings: number, numReturnings: number): ErrorCode
+        // Throws a TypeError if a returning isn't of its requested type,
+        // `SlotType.Unknown` skips the check and yields `undefined`. Usings
+        // are an array or a buffer of packed values, see `packValues`, and
+        // returnings come back packed if `packed` is set. A malformed buffer
+        // throws a RangeError.
+        invoke(program: [string, string], usings: Using[] | Buffer, returningTypes: SlotType[]): InvokeResult
+        invoke(
+                program: [string, string], usings: Using[] | Buffer, returningTypes: SlotType[],
+                packed: true): PackedInvokeResult
+        runRecords(
+                program: [string, string], input: RecordCodecNative, output: RecordCodecNative,
+                buf: Buffer, firstRecord: number, count: number): RunRecordsResult
+        setCacheable(module: string, program: string, cacheable: boolean): void
+        setResultCacheLimits(maxEntries: number, maxBytes: number): void
+        clearResultCache(): void
+        resultCacheStats(): ResultCacheStats
+        setTracing(enabled: boolean, capacity: number, sampleEvery: number): void
+        traceDump(): string
+        traceClear(): void
 }
 
 export var CamNative: {
-        new(): CamNative
+        new(nativePrograms?: boolean): CamNative
 } = native.CamNative
 
+export interface CamOptions
+{
+        // Registers SYSTEM:SORT, SYSTEM:MERGE and the native indexed and
+        // sequential file programs, the file programs not on Windows. They
+        // open whatever paths the programs pass them, so they are off by
+        // default.
+        nativePrograms?: boolean
+}
+
+export interface TraceOptions
+{
+        // events kept, older ones are overwritten
+        capacity?: number
+        // trace one top level call out of `sampleEvery`
+        sampleEvery?: number
+}
+
+// Begin/end events for VM calls, foreign programs, marshaling, chunk loads
+// and links, recorded into a ring buffer.
+export class Tracer
+{
+        private cam: CamNative
+        private capacity = 65536
+
+        constructor(cam: CamNative)
+        {
+                this.cam = cam
+        }
+
+        // Changing the capacity drops the events recorded so far.
+        start(options: TraceOptions = {}): void
+        {
+                this.capacity = options.capacity || this.capacity
+                this.cam.setTracing(true, this.capacity, options.sampleEvery || 1)
+        }
+
+        stop(): void
+        {
+                this.cam.setTracing(false, this.capacity, 1)
+        }
+
+        // Chrome Trace Event JSON, loadable in chrome://tracing or Perfetto.
+        dump(): string
+        {
+                return this.cam.traceDump()
+        }
+
+        clear(): void
+        {
+                this.cam.traceClear()
+        }
+}
+
 export class Cam extends CamNative
 {
-        constructor()
+        readonly trace: Tracer = new Tracer(this)
+
+        constructor(options: CamOptions = {})
         {
-                super()
+                super(options.nativePrograms)
 
                 this.addForeign('SYSTEM', 'CONSOLE-WRITE', _ => {
                         process.stdout.write(this.getSlotDisplay(-1))
@@ -74,4 +278,27 @@ export class Cam extends CamNative
         {
                 return this.addChunkBuffer(readFileSync(path))
         }
+
+        // Adds the chunks of the bundle that `roots` need, every chunk if
+        // not given. The bundle stays referenced by the instance as one
+        // buffer.
+        addBundle(bundle: Bundle | string, roots?: ProgramRef[]): ErrorCode
+        {
+                if (typeof bundle === 'string') {
+                        bundle = Bundle.open(bundle)
+                }
+                const chunks = roots ? bundle.chunksFor(roots) : [...Array(bundle.numChunks).keys()]
+                for (const i of chunks) {
+                        const ec = this.addChunkBuffer(bundle.chunk(i))
+                        if (ec !== ErrorCode.Success) {
+                                return ec
+                        }
+                }
+                return ErrorCode.Success
+        }
+
+        createTransform(options: RecordTransformOptions): RecordTransform
+        {
+                return new RecordTransform(this, options)
+        }
 }
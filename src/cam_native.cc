@@ -1,12 +1,38 @@
-#include <cam.h>
+#include "native_common.h"
 #include <cam/memory.h>
 
 #include <node_api.h>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
 #include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <memory>
 #include <map>
+#include <set>
+#include <list>
+#include <string>
+#include <thread>
+#include <unordered_map>
 
 using namespace std;
 
@@ -14,6 +40,15 @@ using namespace std;
 
 namespace cam { namespace native {
 
+class RecordCodec;
+RecordCodec* RecordCodecUnwrap   (napi_env env, napi_value codec);
+int          RecordCodecLength   (const RecordCodec *codec);
+int          RecordCodecNumFields(const RecordCodec *codec);
+cam_error_t  RecordCodecDecode   (RecordCodec *codec, struct cam_s *cam, const uint8_t *buf, size_t buf_len,
+                                  int first_record, int count, int first_slot);
+cam_error_t  RecordCodecEncode   (RecordCodec *codec, struct cam_s *cam, int first_slot, uint8_t *buf, size_t buf_len,
+                                  int first_record, int count);
+
 static bool is_undefined(napi_env env, napi_value v)
 {
         napi_valuetype t;
@@ -68,6 +103,266 @@ static const void* chunk_allocator_take(chunk_allocator &a, napi_value buf)
         return chunk;
 }
 
+// Chunks read off the main thread by `addChunksAsync`, each one into its
+// own buffer. The workers only do the I/O, the VM only sees the chunks
+// once they are added on the main thread.
+struct chunk_load
+{
+        string path;
+        void *data;
+        size_t size;
+        cam_error_t ec;
+        string error;
+        bool added;
+        double read_ms;
+        double add_ms;
+};
+
+struct chunk_load_job
+{
+        napi_async_work work;
+        napi_deferred deferred;
+        napi_ref cam_ref;
+        vector<chunk_load> chunks;
+        double elapsed_ms;
+};
+
+static void free_buffer(napi_env, void *data, void *)
+{
+        free(data);
+}
+
+struct file_closer
+{
+        void operator()(FILE *f) const { if (f) fclose(f); }
+};
+
+static void load_chunk(chunk_load &c)
+{
+        const auto started = chrono::steady_clock::now();
+
+        unique_ptr<FILE, file_closer> f(fopen(c.path.c_str(), "rb"));
+        long size = -1;
+        if (f && fseek(f.get(), 0, SEEK_END) == 0) {
+                size = ftell(f.get());
+        }
+        if (size < 0 || fseek(f.get(), 0, SEEK_SET) != 0) {
+                c.ec = CEC_NOT_FOUND;
+                c.error = strerror(errno);
+                return;
+        }
+
+        c.size = (size_t)size;
+        c.data = malloc(c.size ? c.size : 1);
+        if (!c.data || fread(c.data, 1, c.size, f.get()) != c.size) {
+                c.ec = c.data ? CEC_UNEXPECTED : CEC_NO_MEMORY;
+                c.error = c.data ? "short read" : "out of memory";
+                free(c.data);
+                c.data = nullptr;
+                return;
+        }
+
+        c.read_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+}
+
+static void load_chunks_execute(napi_env, void *data)
+{
+        auto job = (chunk_load_job*)data;
+        const auto started = chrono::steady_clock::now();
+
+        const size_t num_threads = min<size_t>(max(1u, thread::hardware_concurrency()), job->chunks.size());
+        atomic<size_t> next(0);
+        auto worker = [job, &next] {
+                for (size_t i; (i = next++) < job->chunks.size(); ) {
+                        load_chunk(job->chunks[i]);
+                }
+        };
+
+        vector<thread> threads;
+        for (size_t i = 1; i < num_threads; ++i) {
+                threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &t : threads) {
+                t.join();
+        }
+
+        job->elapsed_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+}
+
+struct trace_event
+{
+        uint64_t ts_ns;
+        const char *category;
+        const char *name;
+        char phase;
+};
+
+// Fixed size ring of begin/end events, only ever touched from the thread
+// owning the instance, so recording is a clock read and a store. Sampling
+// is decided per top level call, nested events follow that decision.
+struct tracer
+{
+        bool enabled;
+        bool sampled;
+        uint32_t sample_every;
+        uint64_t top_level_calls;
+        vector<trace_event> ring;
+        size_t next;
+        uint64_t recorded;
+        // OS id of the owning thread
+        int64_t tid;
+        // "module:program" of invoked programs, whose own names don't
+        // outlive the call, by module then program so that a lookup
+        // doesn't build the name
+        map<string, map<string, string>> names;
+};
+
+static int64_t current_thread_id()
+{
+#if defined(__linux__)
+        return (int64_t)syscall(SYS_gettid);
+#elif defined(__APPLE__)
+        uint64_t tid;
+        pthread_threadid_np(nullptr, &tid);
+        return (int64_t)tid;
+#elif defined(_WIN32)
+        return (int64_t)GetCurrentThreadId();
+#else
+        return 1;
+#endif
+}
+
+static void tracer_init(tracer &t)
+{
+        t.tid = current_thread_id();
+        t.enabled = false;
+        t.sampled = true;
+        t.sample_every = 1;
+        t.top_level_calls = 0;
+        t.next = 0;
+        t.recorded = 0;
+}
+
+static void tracer_record(tracer &t, char phase, const char *category, const char *name)
+{
+        auto &e = t.ring[t.next];
+        e.ts_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        e.category = category;
+        e.name = name;
+        e.phase = phase;
+        t.next = t.next + 1 == t.ring.size() ? 0 : t.next + 1;
+        ++t.recorded;
+}
+
+static void tracer_sample(tracer &t)
+{
+        t.sampled = t.top_level_calls++ % t.sample_every == 0;
+}
+
+// interned once per program
+static const char* tracer_name(tracer &t, const string &module, const string &program)
+{
+        auto m = t.names.find(module);
+        if (m == t.names.end()) {
+                m = t.names.emplace(module, map<string, string>()).first;
+        }
+        auto p = m->second.find(program);
+        if (p == m->second.end()) {
+                p = m->second.emplace(program, module + ":" + program).first;
+        }
+        return p->second.c_str();
+}
+
+class trace_scope
+{
+public:
+        trace_scope(tracer &t, const char *category, const char *name, bool always = false)
+                : _t(t.enabled && (t.sampled || always) ? &t : nullptr)
+                , _category(category)
+                , _name(name)
+        {
+                if (_t) {
+                        tracer_record(*_t, 'B', _category, _name);
+                }
+        }
+
+       ~trace_scope()
+        {
+                if (_t) {
+                        tracer_record(*_t, 'E', _category, _name);
+                }
+        }
+
+private:
+        tracer *_t;
+        const char *_category;
+        const char *_name;
+};
+
+static void json_append_string(string &out, const char *s)
+{
+        out.push_back('"');
+        for (; *s; ++s) {
+                const unsigned char c = *s;
+                if (c == '"' || c == '\\') {
+                        out.push_back('\\');
+                        out.push_back(c);
+                } else if (c < 0x20) {
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        out.append(buf);
+                } else {
+                        out.push_back(c);
+                }
+        }
+        out.push_back('"');
+}
+
+// Chrome Trace Event format, also read by Perfetto. Ends whose begin was
+// overwritten by the ring are dropped so the nesting stays balanced.
+static string tracer_dump(const tracer &t)
+{
+        const size_t size  = (size_t)min<uint64_t>(t.recorded, t.ring.size());
+        const size_t first = t.recorded > t.ring.size() ? t.next : 0;
+
+        string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+#if defined(_WIN32)
+        const int pid = _getpid();
+#else
+        const int pid = (int)getpid();
+#endif
+        int depth = 0;
+        bool comma = false;
+        for (size_t i = 0; i < size; ++i) {
+                const auto &e = t.ring[(first + i) % t.ring.size()];
+                if (e.phase == 'E') {
+                        if (depth == 0) {
+                                continue;
+                        }
+                        --depth;
+                } else {
+                        ++depth;
+                }
+
+                char buf[128];
+                snprintf(buf, sizeof(buf), ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%lld}",
+                         e.phase, (double)e.ts_ns / 1000.0, pid, (long long)t.tid);
+
+                if (comma) {
+                        out.push_back(',');
+                }
+                out.append("{\"name\":");
+                json_append_string(out, e.name);
+                out.append(",\"cat\":");
+                json_append_string(out, e.category);
+                out.append(buf);
+                comma = true;
+        }
+        out.append("]}");
+        return out;
+}
+
 struct ForeignProgram
 {
         napi_env env;
@@ -76,6 +371,7 @@ struct ForeignProgram
         shared_ptr<char> module;
         shared_ptr<char> program;
         cam_foreign_program_t cfp;
+        tracer *trace;
 };
 
 static void call_foreign_program(struct cam_s *, int num_usings, void *ud)
@@ -91,163 +387,944 @@ static void call_foreign_program(struct cam_s *, int num_usings, void *ud)
         status = napi_create_int32(fp->env, num_usings, argv);
         assert(status == napi_ok);
 
+        trace_scope scope(*fp->trace, "foreign", fp->program.get());
         status = napi_call_function(fp->env, fp->recv, f, 1, argv, nullptr);
         assert(status == napi_ok);
 }
 
-static void release_foreign_programs(vector<shared_ptr<ForeignProgram>> &fps)
+static shared_ptr<char> get_value_string(napi_env env, napi_value v)
 {
-        for (int i = 0; i < fps.size(); ++i) {
-                auto &fp = fps[i];
-                napi_delete_reference(fp->env, fp->ref);
-        }
+        napi_status status;
 
-        fps.clear();
+        size_t str_len, copied_len;
+        status = napi_get_value_string_utf8(env, v, nullptr, 0, &str_len);
+        assert(status == napi_ok);
+        shared_ptr<char> str(new char[str_len + 1], default_delete<char[]>());
+        status = napi_get_value_string_utf8(env, v, str.get(), str_len + 1, &copied_len);
+        assert(status == napi_ok && str_len == copied_len);
+
+        return str;
 }
 
-class Cam
+static void get_value_comp_4(
+        napi_env env, napi_value c4, bool *is_signed, int *scale, cam_comp_4_t *value)
 {
-private:
-        Cam(napi_env env)
-                : _env(env)
-                , _wrapper(nullptr)
-                , _cam(nullptr)
-        {
-                cam_error_t ec;
-                _cam = cam_init(&ec);
-                assert(ec == CEC_SUCCESS);
-                chunk_allocator_init(_chunk_allocator, env);
-        }
+        napi_status status;
 
-       ~Cam()
-        {
-                cam_drop(_cam);
-                release_foreign_programs(_foreign_programs);
-                chunk_allocator_drop(_chunk_allocator);
-                napi_delete_reference(_env, _wrapper);
-        }
+        napi_value c4v;
 
-        static napi_value New(napi_env env, napi_callback_info info)
-        {
-                napi_status status;
+        status = napi_get_named_property(env, c4, "isSigned", &c4v);
+        assert(status == napi_ok);
+        status = napi_get_value_bool(env, c4v, is_signed);
+        assert(status == napi_ok);
 
-                napi_value jsthis;
-                status = napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr);
-                assert(status == napi_ok);
+        status = napi_get_named_property(env, c4, "scale", &c4v);
+        assert(status == napi_ok);
+        status = napi_get_value_int32(env, c4v, scale);
+        assert(status == napi_ok);
 
-                Cam *obj = new Cam(env);
-                status = napi_wrap(env, jsthis, (void*)obj, &Cam::Destructor, nullptr, &obj->_wrapper);
-                assert(status == napi_ok);
+        bool lossless;
+        status = napi_get_named_property(env, c4, "value", &c4v);
+        assert(status == napi_ok);
+        status = napi_get_value_bigint_int64(env, c4v, value, &lossless);
+        assert(status == napi_ok && lossless);
+}
 
-                return jsthis;
-        }
+static napi_value create_comp_4(napi_env env, bool is_signed, int scale, cam_comp_4_t value)
+{
+        napi_status status;
 
-        static napi_value AddChunkBuffer(napi_env env, napi_callback_info info)
-        {
-                napi_status status;
+        napi_value c4v;
+        status = napi_create_object(env, &c4v);
+        assert(status == napi_ok);
 
-                size_t argc = 1;
-                napi_value jsthis, chunk_buffer;
-                status = napi_get_cb_info(env, info, &argc, &chunk_buffer, &jsthis, nullptr);
-                assert(status == napi_ok && argc == 1);
+        napi_value v;
 
-                Cam *obj;
-                status = napi_unwrap(env, jsthis, (void**)&obj);
-                assert(status == napi_ok);
+        status = napi_get_boolean(env, is_signed, &v);
+        assert(status == napi_ok);
+        status = napi_set_named_property(env, c4v, "isSigned", v);
 
-                napi_value ret;
-                const void *chunk = chunk_allocator_take(obj->_chunk_allocator, chunk_buffer);
-                cam_error_t ec = cam_add_chunk(obj->_cam, chunk, (struct cam_alloc_s*)&obj->_chunk_allocator);
-                status = napi_create_int32(env, ec, &ret);
-                return ret;
-        }
+        status = napi_create_int32(env, scale, &v);
+        assert(status == napi_ok);
+        status = napi_set_named_property(env, c4v, "scale", v);
 
-        static napi_value AddForeign(napi_env env, napi_callback_info info)
-        {
-                napi_status status;
+        status = napi_create_bigint_int64(env, value, &v);
+        assert(status == napi_ok);
+        status = napi_set_named_property(env, c4v, "value", v);
 
-                size_t argc = 3;
-                napi_value jsthis, argv[3];
-                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
-                assert(status == napi_ok && argc == 3);
+        return c4v;
+}
 
-                auto fp = make_shared<ForeignProgram>();
+// Sets `slot` from a JS value: number as Comp2, string as Display,
+// undefined/null as empty Display and anything else as Comp4.
+static void set_slot_value(napi_env env, struct cam_s *cam, int slot, napi_value v)
+{
+        napi_status status;
 
-                fp->env = env;
+        napi_valuetype t;
+        status = napi_typeof(env, v, &t);
+        assert(status == napi_ok);
 
-                status = napi_create_reference(env, argv[2], 1, &fp->ref);
+        switch (t) {
+        case napi_number: {
+                double value;
+                status = napi_get_value_double(env, v, &value);
                 assert(status == napi_ok);
+                cam_set_slot_comp_2(cam, slot, value);
+                break; }
+        case napi_string: {
+                size_t display_len, copied_len;
+                status = napi_get_value_string_utf8(env, v, nullptr, 0, &display_len);
+                assert(status == napi_ok);
+                char *str = cam_set_slot_display(cam, slot, nullptr, display_len);
+                status = napi_get_value_string_utf8(env, v, str, display_len + 1, &copied_len);
+                assert(status == napi_ok && display_len == copied_len);
+                break; }
+        case napi_undefined:
+        case napi_null:
+                cam_set_slot_display(cam, slot, "", 1);
+                break;
+        default: {
+                bool is_signed;
+                int scale;
+                cam_comp_4_t value;
+                get_value_comp_4(env, v, &is_signed, &scale, &value);
+                cam_set_slot_comp_4(cam, slot, is_signed, scale, value);
+                break; }
+        }
+}
 
-                fp->recv = jsthis;
-
-                size_t str_len, copied_len;
+static napi_value get_slot_value(napi_env env, struct cam_s *cam, int slot, int type)
+{
+        napi_status status;
 
-                status = napi_get_value_string_utf8(env, argv[0], nullptr, 0, &str_len);
+        napi_value ret;
+        switch (type) {
+        case SLOT_COMP_2:
+                status = napi_create_double(env, cam_get_slot_comp_2(cam, slot), &ret);
                 assert(status == napi_ok);
-                fp->module.reset(new char[str_len + 1]);
-                status = napi_get_value_string_utf8(env, argv[0], fp->module.get(), str_len + 1, &copied_len);
-                assert(status == napi_ok && str_len == copied_len);
-
-                status = napi_get_value_string_utf8(env, argv[1], nullptr, 0, &str_len);
+                break;
+        case SLOT_COMP_4: {
+                bool is_signed;
+                int scale;
+                cam_comp_4_t value = cam_get_slot_comp_4(cam, slot, &is_signed, &scale);
+                ret = create_comp_4(env, is_signed, scale, value);
+                break; }
+        case SLOT_DISPLAY: {
+                int length;
+                const char *str = cam_get_slot_display(cam, slot, &length);
+                status = napi_create_string_utf8(env, str, length, &ret);
                 assert(status == napi_ok);
-                fp->program.reset(new char[str_len + 1]);
-                status = napi_get_value_string_utf8(env, argv[1], fp->program.get(), str_len + 1, &copied_len);
-                assert(status == napi_ok && str_len == copied_len);
-
-                fp->cfp.module  = fp->module.get();
-                fp->cfp.program = fp->program.get();
-                fp->cfp.func    = &call_foreign_program;
-                fp->cfp.ud      = fp.get();
-
-                Cam *obj;
-                status = napi_unwrap(env, jsthis, (void**)&obj);
+                break; }
+        default:
+                status = napi_get_undefined(env, &ret);
                 assert(status == napi_ok);
+                break;
+        }
 
-                obj->_foreign_programs.push_back(fp);
-                cam_add_foreign(obj->_cam, &fp->cfp);
+        return ret;
+}
 
-                return nullptr;
+// Packed values, as `invoke` takes usings and returns returnings: one
+// after the other, a SlotType byte followed by, for Comp2, a float64, for
+// Comp4, a signed byte, an int32 scale and an int64, and for Display, an
+// int32 length and the bytes. Numbers are in host byte order, Unknown and
+// Program carry nothing; an Unknown using is an empty Display, like
+// `undefined` in an array.
+static const size_t PACKED_COMP_2_SIZE  = sizeof(double);
+static const size_t PACKED_COMP_4_SIZE  = 1 + sizeof(int32_t) + sizeof(cam_comp_4_t);
+
+// Number of values in `buf`, -1 if it's malformed.
+static int packed_count(const uint8_t *buf, size_t len)
+{
+        int count = 0;
+        for (size_t i = 0; i < len; ++count) {
+                const int type = buf[i++];
+                size_t size = 0;
+                switch (type) {
+                case SLOT_UNKNOWN:
+                        break;
+                case SLOT_COMP_2:
+                        size = PACKED_COMP_2_SIZE;
+                        break;
+                case SLOT_COMP_4:
+                        size = PACKED_COMP_4_SIZE;
+                        break;
+                case SLOT_DISPLAY: {
+                        int32_t length;
+                        if (len - i < sizeof(length)) {
+                                return -1;
+                        }
+                        memcpy(&length, buf + i, sizeof(length));
+                        if (length < 0) {
+                                return -1;
+                        }
+                        size = sizeof(length) + (size_t)length;
+                        break; }
+                default:
+                        return -1;
+                }
+                if (len - i < size) {
+                        return -1;
+                }
+                i += size;
         }
+        return count;
+}
 
-        static napi_value Link(napi_env env, napi_callback_info info)
-        {
-                napi_status status;
+// Sets `first_slot` onwards from values `packed_count` accepted.
+static void set_slots_packed(struct cam_s *cam, int first_slot, const uint8_t *buf, size_t len)
+{
+        for (size_t i = 0; i < len; ++first_slot) {
+                switch (buf[i++]) {
+                case SLOT_UNKNOWN:
+                        cam_set_slot_display(cam, first_slot, "", 1);
+                        break;
+                case SLOT_COMP_2: {
+                        double value;
+                        memcpy(&value, buf + i, sizeof(value));
+                        cam_set_slot_comp_2(cam, first_slot, value);
+                        i += PACKED_COMP_2_SIZE;
+                        break; }
+                case SLOT_COMP_4: {
+                        int32_t scale;
+                        cam_comp_4_t value;
+                        memcpy(&scale, buf + i + 1, sizeof(scale));
+                        memcpy(&value, buf + i + 1 + sizeof(scale), sizeof(value));
+                        cam_set_slot_comp_4(cam, first_slot, buf[i] != 0, scale, value);
+                        i += PACKED_COMP_4_SIZE;
+                        break; }
+                default: {
+                        int32_t length;
+                        memcpy(&length, buf + i, sizeof(length));
+                        i += sizeof(length);
+                        cam_set_slot_display(cam, first_slot, (const char*)buf + i, length);
+                        i += length;
+                        break; }
+                }
+        }
+}
 
-                napi_value jsthis;
-                status = napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr);
-                assert(status == napi_ok);
+// Appends `slot` as a packed value of `type`, its bytes are only there
+// for the types that carry any.
+static void packed_append(string &out, struct cam_s *cam, int slot, int type)
+{
+        out.push_back((char)type);
+
+        switch (type) {
+        case SLOT_COMP_2: {
+                double value = cam_get_slot_comp_2(cam, slot);
+                out.append((const char*)&value, sizeof(value));
+                break; }
+        case SLOT_COMP_4: {
+                bool is_signed;
+                int32_t scale;
+                cam_comp_4_t value = cam_get_slot_comp_4(cam, slot, &is_signed, &scale);
+                out.push_back((char)is_signed);
+                out.append((const char*)&scale, sizeof(scale));
+                out.append((const char*)&value, sizeof(value));
+                break; }
+        case SLOT_DISPLAY: {
+                int32_t length;
+                const char *str = cam_get_slot_display(cam, slot, &length);
+                out.append((const char*)&length, sizeof(length));
+                out.append(str, length);
+                break; }
+        default:
+                break;
+        }
+}
 
-                Cam *obj;
-                status = napi_unwrap(env, jsthis, (void**)&obj);
-                assert(status == napi_ok);
+struct cached_value
+{
+        int type;
+        bool is_signed;
+        int scale;
+        cam_comp_4_t comp_4;
+        double comp_2;
+        string display;
+};
 
-                napi_value ret;
-                cam_error_t ec = cam_link(obj->_cam);
-                status = napi_create_int32(env, ec, &ret);
-                return ret;
-        }
+typedef pair<string, vector<cached_value>> result_cache_entry;
 
-        static napi_value EnsureSlots(napi_env env, napi_callback_info info)
-        {
-                napi_status status;
+// LRU of returnings for programs marked as pure, keyed by the program
+// name and the marshaled bytes of its usings.
+struct result_cache
+{
+        set<string> cacheable;
+        list<result_cache_entry> lru;
+        unordered_map<string, list<result_cache_entry>::iterator> entries;
+        size_t max_entries;
+        size_t max_bytes;
+        size_t bytes;
+        uint64_t hits;
+        uint64_t misses;
+        // calls with a using that can't be keyed or a returning that
+        // can't be replayed, e.g. a program
+        uint64_t uncacheable;
+        int generation;
+};
 
-                size_t argc = 1;
-                napi_value jsthis, argv[1];
-                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
-                assert(status == napi_ok && argc == 1);
+static string result_cache_program(const char *module, const char *program)
+{
+        string name(module);
+        name.push_back('\0');
+        name.append(program);
+        return name;
+}
 
-                Cam *obj;
-                status = napi_unwrap(env, jsthis, (void**)&obj);
-                assert(status == napi_ok);
+static void result_cache_init(result_cache &c)
+{
+        c.max_entries = 1024;
+        c.max_bytes   = 16 * 1024 * 1024;
+        c.bytes       = 0;
+        c.hits        = 0;
+        c.misses      = 0;
+        c.uncacheable = 0;
+        c.generation  = 0;
+}
 
-                int32_t num_slots;
-                status = napi_get_value_int32(env, argv[0], &num_slots);
-                cam_ensure_slots(obj->_cam, num_slots);
+static void result_cache_clear(result_cache &c)
+{
+        c.lru.clear();
+        c.entries.clear();
+        c.bytes = 0;
+}
 
-                return nullptr;
+static size_t result_cache_entry_bytes(const result_cache_entry &e)
+{
+        size_t bytes = e.first.size();
+        for (int i = 0; i < e.second.size(); ++i) {
+                bytes += sizeof(cached_value) + e.second[i].display.size();
         }
+        return bytes;
+}
 
-        static napi_value NumSlots(napi_env env, napi_callback_info info)
+static void result_cache_evict(result_cache &c)
+{
+        while (!c.lru.empty() && (c.entries.size() > c.max_entries || c.bytes > c.max_bytes)) {
+                auto &e = c.lru.back();
+                c.bytes -= result_cache_entry_bytes(e);
+                c.entries.erase(e.first);
+                c.lru.pop_back();
+        }
+}
+
+// Appends the type tag and bytes of `slot` to `key`, packed. Fails for a
+// slot whose value the bytes don't capture, e.g. a program.
+static bool result_cache_key_append(string &key, struct cam_s *cam, int slot)
+{
+        const int type = (int)cam_slot_type(cam, slot);
+        if (type != SLOT_COMP_2 && type != SLOT_COMP_4 && type != SLOT_DISPLAY) {
+                return false;
+        }
+        packed_append(key, cam, slot, type);
+        return true;
+}
+
+static const vector<cached_value>* result_cache_find(result_cache &c, const string &key)
+{
+        auto itr = c.entries.find(key);
+        if (itr == c.entries.end()) {
+                ++c.misses;
+                return nullptr;
+        }
+
+        ++c.hits;
+        c.lru.splice(c.lru.begin(), c.lru, itr->second);
+        return &itr->second->second;
+}
+
+static void result_cache_store(result_cache &c, const string &key, struct cam_s *cam, int num_returnings)
+{
+        if (c.entries.find(key) != c.entries.end()) {
+                return;
+        }
+
+        vector<cached_value> returnings(num_returnings);
+        for (int slot = 0; slot < num_returnings; ++slot) {
+                auto &cv = returnings[slot];
+                cv.type = (int)cam_slot_type(cam, slot);
+                switch (cv.type) {
+                case SLOT_COMP_2:
+                        cv.comp_2 = cam_get_slot_comp_2(cam, slot);
+                        break;
+                case SLOT_COMP_4:
+                        cv.comp_4 = cam_get_slot_comp_4(cam, slot, &cv.is_signed, &cv.scale);
+                        break;
+                case SLOT_DISPLAY: {
+                        int length;
+                        const char *str = cam_get_slot_display(cam, slot, &length);
+                        cv.display.assign(str, length);
+                        break; }
+                default:
+                        // can't be replayed, so it couldn't have been a hit
+                        --c.misses;
+                        ++c.uncacheable;
+                        return;
+                }
+        }
+
+        c.lru.emplace_front(key, move(returnings));
+        c.entries[key] = c.lru.begin();
+        c.bytes += result_cache_entry_bytes(c.lru.front());
+        result_cache_evict(c);
+}
+
+static void result_cache_replay(const vector<cached_value> &returnings, struct cam_s *cam)
+{
+        for (int slot = 0; slot < returnings.size(); ++slot) {
+                auto &cv = returnings[slot];
+                switch (cv.type) {
+                case SLOT_COMP_2:
+                        cam_set_slot_comp_2(cam, slot, cv.comp_2);
+                        break;
+                case SLOT_COMP_4:
+                        cam_set_slot_comp_4(cam, slot, cv.is_signed, cv.scale, cv.comp_4);
+                        break;
+                default:
+                        cam_set_slot_display(cam, slot, cv.display.c_str(), (int)cv.display.size());
+                        break;
+                }
+        }
+}
+
+// A [module, program] pair, short names stay in the strings' inline
+// storage.
+struct program_name
+{
+        string module;
+        string program;
+};
+
+static void get_value_string(napi_env env, napi_value v, string &str)
+{
+        napi_status status;
+
+        size_t str_len, copied_len;
+        status = napi_get_value_string_utf8(env, v, nullptr, 0, &str_len);
+        assert(status == napi_ok);
+        str.resize(str_len + 1);
+        status = napi_get_value_string_utf8(env, v, &str[0], str_len + 1, &copied_len);
+        assert(status == napi_ok && str_len == copied_len);
+        str.resize(str_len);
+}
+
+static void get_program_name(napi_env env, napi_value v, program_name &name)
+{
+        napi_status status;
+
+        napi_value s;
+        status = napi_get_element(env, v, 0, &s);
+        assert(status == napi_ok);
+        get_value_string(env, s, name.module);
+        status = napi_get_element(env, v, 1, &s);
+        assert(status == napi_ok);
+        get_value_string(env, s, name.program);
+}
+
+// Appends the UTF-8 of the JS string `v` to `str`.
+static void append_value_string(napi_env env, napi_value v, string &str)
+{
+        napi_status status;
+
+        size_t str_len, copied_len;
+        status = napi_get_value_string_utf8(env, v, nullptr, 0, &str_len);
+        assert(status == napi_ok);
+        const size_t offset = str.size();
+        str.resize(offset + str_len + 1);
+        status = napi_get_value_string_utf8(env, v, &str[offset], str_len + 1, &copied_len);
+        assert(status == napi_ok && str_len == copied_len);
+        str.resize(offset + str_len);
+}
+
+// [module, program] pairs that resolved under the current link, interned
+// per instance. The key is the module length followed by both names, read
+// straight from the JS strings into the reused `key`, so setting a known
+// program copies nothing to the heap. Cleared whenever the link generation
+// moves, entries never outlive the chunks they resolved against.
+struct program_table
+{
+        unordered_map<string, program_name> names;
+        int generation;
+        string key;
+};
+
+static void program_table_init(program_table &t)
+{
+        t.generation = 0;
+}
+
+static void program_table_key(napi_env env, program_table &t, napi_value module, napi_value program)
+{
+        t.key.resize(sizeof(uint32_t));
+        append_value_string(env, module, t.key);
+        const uint32_t module_len = (uint32_t)(t.key.size() - sizeof(uint32_t));
+        memcpy(&t.key[0], &module_len, sizeof(module_len));
+        append_value_string(env, program, t.key);
+}
+
+static void release_foreign_programs(vector<shared_ptr<ForeignProgram>> &fps)
+{
+        for (int i = 0; i < fps.size(); ++i) {
+                auto &fp = fps[i];
+                napi_delete_reference(fp->env, fp->ref);
+        }
+
+        fps.clear();
+}
+
+// tags wrapped instances, so that an unwrap can tell a Cam from any other
+// object
+static const napi_type_tag cam_type_tag = {
+        0x91c9ea98693e4f73ULL, 0x8b933ca45a1e724fULL
+};
+
+class Cam
+{
+private:
+        Cam(napi_env env)
+                : _env(env)
+                , _wrapper(nullptr)
+                , _cam(nullptr)
+                , _indexed_files(nullptr)
+                , _sequential_files(nullptr)
+                , _lazy_link(false)
+                , _link_dirty(false)
+                , _call_depth(0)
+                , _link_generation(0)
+        {
+                cam_error_t ec;
+                _cam = cam_init(&ec);
+                assert(ec == CEC_SUCCESS);
+                chunk_allocator_init(_chunk_allocator, env);
+                program_table_init(_programs);
+                result_cache_init(_result_cache);
+                tracer_init(_tracer);
+        }
+
+        // The native SYSTEM programs open any path their caller passes, so
+        // they are only there when asked for, once per instance.
+        void AddNativePrograms()
+        {
+                if (!_native_programs.empty()) {
+                        return;
+                }
+                // registered once the vector stops growing
+                SortPrograms          (_native_programs);
+#ifdef CAM_NATIVE_FILES
+                _indexed_files    = indexed_files_new();
+                _sequential_files = sequential_files_new();
+                IndexedFilePrograms   (_native_programs, _indexed_files);
+                SequentialFilePrograms(_native_programs, _sequential_files);
+#endif
+                for (int i = 0; i < _native_programs.size(); ++i) {
+                        cam_add_foreign(_cam, &_native_programs[i]);
+                }
+                _link_dirty = true;
+        }
+
+       ~Cam()
+        {
+                cam_drop(_cam);
+#ifdef CAM_NATIVE_FILES
+                if (_indexed_files) {
+                        indexed_files_drop(_indexed_files);
+                }
+                if (_sequential_files) {
+                        sequential_files_drop(_sequential_files);
+                }
+#endif
+                release_foreign_programs(_foreign_programs);
+                chunk_allocator_drop(_chunk_allocator);
+                napi_delete_reference(_env, _wrapper);
+        }
+
+        static napi_value New(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 1;
+                napi_value jsthis, argv[1];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok);
+
+                bool native_programs = false;
+                if (argc >= 1) {
+                        napi_valuetype type;
+                        status = napi_typeof(env, argv[0], &type);
+                        assert(status == napi_ok);
+                        if (type != napi_undefined) {
+                                status = napi_get_value_bool(env, argv[0], &native_programs);
+                                if (status != napi_ok) {
+                                        napi_throw_type_error(env, nullptr, "nativePrograms must be a boolean");
+                                        return nullptr;
+                                }
+                        }
+                }
+
+                Cam *obj = new Cam(env);
+                if (native_programs) {
+                        obj->AddNativePrograms();
+                }
+                status = napi_wrap(env, jsthis, (void*)obj, &Cam::Destructor, nullptr, &obj->_wrapper);
+                assert(status == napi_ok);
+                status = napi_type_tag_object(env, jsthis, &cam_type_tag);
+                assert(status == napi_ok);
+
+                return jsthis;
+        }
+
+        static napi_value AddChunkBuffer(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 1;
+                napi_value jsthis, chunk_buffer;
+                status = napi_get_cb_info(env, info, &argc, &chunk_buffer, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 1);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                trace_scope scope(obj->_tracer, "load", "addChunkBuffer", true);
+                napi_value ret;
+                const void *chunk = chunk_allocator_take(obj->_chunk_allocator, chunk_buffer);
+                cam_error_t ec = cam_add_chunk(obj->_cam, chunk, (struct cam_alloc_s*)&obj->_chunk_allocator);
+                if (ec == CEC_SUCCESS) {
+                        obj->_link_dirty = true;
+                }
+                status = napi_create_int32(env, ec, &ret);
+                return ret;
+        }
+
+        // Reads the chunk files on worker threads, then adds each of them
+        // once, in order, on the main thread. There's no removing a chunk
+        // from the VM, so a failed add leaves the ones before it added.
+        static napi_value AddChunksAsync(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 1;
+                napi_value jsthis, paths;
+                status = napi_get_cb_info(env, info, &argc, &paths, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 1);
+
+                auto job = new chunk_load_job();
+
+                uint32_t num_paths;
+                status = napi_get_array_length(env, paths, &num_paths);
+                assert(status == napi_ok);
+                job->chunks.resize(num_paths);
+                for (uint32_t i = 0; i < num_paths; ++i) {
+                        napi_value path;
+                        status = napi_get_element(env, paths, i, &path);
+                        assert(status == napi_ok);
+                        auto str = get_value_string(env, path);
+                        auto &c = job->chunks[i];
+                        c.path = str.get();
+                        c.data = nullptr;
+                        c.size = 0;
+                        c.ec = CEC_SUCCESS;
+                        c.added = false;
+                        c.read_ms = 0;
+                        c.add_ms = 0;
+                }
+                job->elapsed_ms = 0;
+
+                // keeps the instance alive until the job completes
+                status = napi_create_reference(env, jsthis, 1, &job->cam_ref);
+                assert(status == napi_ok);
+
+                napi_value promise, name;
+                status = napi_create_promise(env, &job->deferred, &promise);
+                assert(status == napi_ok);
+                status = napi_create_string_utf8(env, "addChunksAsync", NAPI_AUTO_LENGTH, &name);
+                assert(status == napi_ok);
+                status = napi_create_async_work(env, nullptr, name, &load_chunks_execute, &LoadChunksComplete, job, &job->work);
+                assert(status == napi_ok);
+                status = napi_queue_async_work(env, job->work);
+                assert(status == napi_ok);
+
+                return promise;
+        }
+
+        static void LoadChunksComplete(napi_env env, napi_status work_status, void *data)
+        {
+                napi_status status;
+                auto job = (chunk_load_job*)data;
+
+                napi_value jsthis;
+                status = napi_get_reference_value(env, job->cam_ref, &jsthis);
+                assert(status == napi_ok);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                // a cancelled job read nothing
+                cam_error_t ec = work_status == napi_ok ? CEC_SUCCESS : CEC_UNEXPECTED;
+                for (size_t i = 0; i < job->chunks.size() && ec == CEC_SUCCESS; ++i) {
+                        ec = job->chunks[i].ec;
+                }
+
+                napi_value chunks;
+                status = napi_create_array_with_length(env, job->chunks.size(), &chunks);
+                assert(status == napi_ok);
+                for (size_t i = 0; i < job->chunks.size(); ++i) {
+                        auto &c = job->chunks[i];
+
+                        if (c.data && ec == CEC_SUCCESS) {
+                                const auto started = chrono::steady_clock::now();
+                                napi_value buf;
+                                status = napi_create_external_buffer(env, c.size, c.data, &free_buffer, nullptr, &buf);
+                                assert(status == napi_ok);
+                                const void *chunk = chunk_allocator_take(obj->_chunk_allocator, buf);
+                                c.ec = cam_add_chunk(obj->_cam, chunk, (struct cam_alloc_s*)&obj->_chunk_allocator);
+                                c.added = c.ec == CEC_SUCCESS;
+                                c.add_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+                                ec = c.ec;
+                                if (c.added) {
+                                        obj->_link_dirty = true;
+                                }
+                        } else {
+                                free(c.data);
+                        }
+                        c.data = nullptr;
+
+                        napi_value entry, v;
+                        status = napi_create_object(env, &entry);
+                        assert(status == napi_ok);
+
+                        status = napi_create_string_utf8(env, c.path.c_str(), c.path.size(), &v);
+                        assert(status == napi_ok);
+                        status = napi_set_named_property(env, entry, "path", v);
+                        assert(status == napi_ok);
+
+                        status = napi_create_int32(env, c.ec, &v);
+                        assert(status == napi_ok);
+                        status = napi_set_named_property(env, entry, "errorCode", v);
+                        assert(status == napi_ok);
+
+                        if (!c.error.empty()) {
+                                status = napi_create_string_utf8(env, c.error.c_str(), c.error.size(), &v);
+                                assert(status == napi_ok);
+                                status = napi_set_named_property(env, entry, "error", v);
+                                assert(status == napi_ok);
+                        }
+
+                        status = napi_get_boolean(env, c.added, &v);
+                        assert(status == napi_ok);
+                        status = napi_set_named_property(env, entry, "added", v);
+                        assert(status == napi_ok);
+
+                        status = napi_create_double(env, (double)c.size, &v);
+                        assert(status == napi_ok);
+                        status = napi_set_named_property(env, entry, "bytes", v);
+                        assert(status == napi_ok);
+
+                        status = napi_create_double(env, c.read_ms, &v);
+                        assert(status == napi_ok);
+                        status = napi_set_named_property(env, entry, "readMs", v);
+                        assert(status == napi_ok);
+
+                        status = napi_create_double(env, c.add_ms, &v);
+                        assert(status == napi_ok);
+                        status = napi_set_named_property(env, entry, "addMs", v);
+                        assert(status == napi_ok);
+
+                        status = napi_set_element(env, chunks, i, entry);
+                        assert(status == napi_ok);
+                }
+
+                napi_value ret, v;
+                status = napi_create_object(env, &ret);
+                assert(status == napi_ok);
+
+                status = napi_create_int32(env, ec, &v);
+                assert(status == napi_ok);
+                status = napi_set_named_property(env, ret, "errorCode", v);
+                assert(status == napi_ok);
+
+                status = napi_create_double(env, job->elapsed_ms, &v);
+                assert(status == napi_ok);
+                status = napi_set_named_property(env, ret, "elapsedMs", v);
+                assert(status == napi_ok);
+
+                status = napi_set_named_property(env, ret, "chunks", chunks);
+                assert(status == napi_ok);
+
+                if (ec == CEC_SUCCESS) {
+                        status = napi_resolve_deferred(env, job->deferred, ret);
+                        assert(status == napi_ok);
+                } else {
+                        const string message = "failed to load chunks: code = " + to_string(ec);
+                        napi_value error, msg;
+                        status = napi_create_string_utf8(env, message.c_str(), message.size(), &msg);
+                        assert(status == napi_ok);
+                        status = napi_create_error(env, nullptr, msg, &error);
+                        assert(status == napi_ok);
+                        status = napi_set_named_property(env, error, "result", ret);
+                        assert(status == napi_ok);
+                        status = napi_reject_deferred(env, job->deferred, error);
+                        assert(status == napi_ok);
+                }
+
+                napi_delete_reference(env, job->cam_ref);
+                napi_delete_async_work(env, job->work);
+                delete job;
+        }
+
+        static napi_value AddForeign(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 3;
+                napi_value jsthis, argv[3];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 3);
+
+                auto fp = make_shared<ForeignProgram>();
+
+                fp->env = env;
+
+                status = napi_create_reference(env, argv[2], 1, &fp->ref);
+                assert(status == napi_ok);
+
+                fp->recv = jsthis;
+
+                size_t str_len, copied_len;
+
+                status = napi_get_value_string_utf8(env, argv[0], nullptr, 0, &str_len);
+                assert(status == napi_ok);
+                fp->module.reset(new char[str_len + 1]);
+                status = napi_get_value_string_utf8(env, argv[0], fp->module.get(), str_len + 1, &copied_len);
+                assert(status == napi_ok && str_len == copied_len);
+
+                status = napi_get_value_string_utf8(env, argv[1], nullptr, 0, &str_len);
+                assert(status == napi_ok);
+                fp->program.reset(new char[str_len + 1]);
+                status = napi_get_value_string_utf8(env, argv[1], fp->program.get(), str_len + 1, &copied_len);
+                assert(status == napi_ok && str_len == copied_len);
+
+                fp->cfp.module  = fp->module.get();
+                fp->cfp.program = fp->program.get();
+                fp->cfp.func    = &call_foreign_program;
+                fp->cfp.ud      = fp.get();
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                fp->trace = &obj->_tracer;
+                obj->_foreign_programs.push_back(fp);
+                cam_add_foreign(obj->_cam, &fp->cfp);
+                obj->_link_dirty = true;
+
+                return nullptr;
+        }
+
+        static napi_value Link(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                napi_value jsthis;
+                status = napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr);
+                assert(status == napi_ok);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                trace_scope scope(obj->_tracer, "load", "link", true);
+                napi_value ret;
+                cam_error_t ec = cam_link(obj->_cam);
+                // a link with nothing added since the last one leaves the
+                // programs as they were, keep the cached results
+                if (obj->_link_dirty || ec != CEC_SUCCESS) {
+                        ++obj->_link_generation;
+                }
+                obj->_link_dirty = ec != CEC_SUCCESS;
+                status = napi_create_int32(env, ec, &ret);
+                return ret;
+        }
+
+        static napi_value SetLazyLink(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 1;
+                napi_value jsthis, argv[1];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 1);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                status = napi_get_value_bool(env, argv[0], &obj->_lazy_link);
+                assert(status == napi_ok);
+
+                return nullptr;
+        }
+
+        // In lazy mode the link is deferred, not incremental: the next
+        // program lookup after chunks or foreign programs were added runs a
+        // full `cam_link`, once, however many were added. Never re-links
+        // underneath a running program (e.g. a foreign program adding
+        // chunks).
+        cam_error_t EnsureLinked()
+        {
+                if (!_lazy_link || !_link_dirty || _call_depth > 0) {
+                        return CEC_SUCCESS;
+                }
+
+                trace_scope scope(_tracer, "load", "link", true);
+                cam_error_t ec = cam_link(_cam);
+                _link_dirty = ec != CEC_SUCCESS;
+                ++_link_generation;
+                return ec;
+        }
+
+        // Entry points called from the VM itself (foreign programs) stay in
+        // the sampling decision of the outermost call.
+        void TraceTopLevel()
+        {
+                if (_tracer.enabled && _call_depth == 0) {
+                        tracer_sample(_tracer);
+                }
+        }
+
+        const char* TraceName(const program_name &name)
+        {
+                if (!_tracer.enabled || !_tracer.sampled) {
+                        return "";
+                }
+                return tracer_name(_tracer, name.module, name.program);
+        }
+
+        static napi_value EnsureSlots(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 1;
+                napi_value jsthis, argv[1];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 1);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t num_slots;
+                status = napi_get_value_int32(env, argv[0], &num_slots);
+                cam_ensure_slots(obj->_cam, num_slots);
+
+                return nullptr;
+        }
+
+        static napi_value NumSlots(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
@@ -264,7 +1341,346 @@ private:
                 return ret;
         }
 
-        static napi_value SlotType(napi_env env, napi_callback_info info)
+        static napi_value SlotType(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 1;
+                napi_value jsthis, argv[1];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 1);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t slot;
+                status = napi_get_value_int32(env, argv[0], &slot);
+                assert(status == napi_ok);
+
+                napi_value ret;
+                status = napi_create_int32(env, cam_slot_type(obj->_cam, slot), &ret);
+                return ret;
+        }
+
+        static napi_value SetSlotComp2(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 2;
+                napi_value jsthis, argv[2];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 2);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t slot;
+                status = napi_get_value_int32(env, argv[0], &slot);
+                assert(status == napi_ok);
+
+                double value;
+                status = napi_get_value_double(env, argv[1], &value);
+                cam_set_slot_comp_2(obj->_cam, slot, value);
+
+                return nullptr;
+        }
+
+        static napi_value SetSlotComp4(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 2;
+                napi_value jsthis, argv[2];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 2);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t slot;
+                status = napi_get_value_int32(env, argv[0], &slot);
+                assert(status == napi_ok);
+
+                bool is_signed;
+                int scale;
+                cam_comp_4_t value;
+                get_value_comp_4(env, argv[1], &is_signed, &scale, &value);
+
+                cam_set_slot_comp_4(obj->_cam, slot, is_signed, scale, value);
+
+                return nullptr;
+        }
+
+        static napi_value SetSlotComp3(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 3;
+                napi_value jsthis, argv[3];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 3);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t slot;
+                status = napi_get_value_int32(env, argv[0], &slot);
+                assert(status == napi_ok);
+
+                uint8_t *packed;
+                size_t packed_len;
+                status = napi_get_buffer_info(env, argv[1], (void**)&packed, &packed_len);
+                assert(status == napi_ok);
+
+                if (packed_len < 1 || packed_len > 10) {
+                        napi_throw_range_error(env, nullptr, "packed decimal length must be within 1 and 10");
+                        return nullptr;
+                }
+
+                int32_t scale;
+                status = napi_get_value_int32(env, argv[2], &scale);
+                assert(status == napi_ok);
+                if (scale < 0 || scale > 18) {
+                        napi_throw_range_error(env, nullptr, "scale must be within 0 and 18");
+                        return nullptr;
+                }
+
+                bool is_signed;
+                cam_comp_4_t value;
+                if (!comp3_unpack(packed, (int)packed_len, &is_signed, &value)) {
+                        napi_throw_range_error(env, nullptr, "bad packed decimal");
+                        return nullptr;
+                }
+                cam_set_slot_comp_4(obj->_cam, slot, is_signed, scale, value);
+
+                return nullptr;
+        }
+
+        static napi_value GetSlotComp3(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 3;
+                napi_value jsthis, argv[3];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 3);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t slot;
+                status = napi_get_value_int32(env, argv[0], &slot);
+                assert(status == napi_ok);
+
+                int32_t length;
+                status = napi_get_value_int32(env, argv[1], &length);
+                assert(status == napi_ok);
+                if (length < 1 || length > 10) {
+                        napi_throw_range_error(env, nullptr, "packed decimal length must be within 1 and 10");
+                        return nullptr;
+                }
+
+                int32_t scale;
+                status = napi_get_value_int32(env, argv[2], &scale);
+                assert(status == napi_ok);
+                if (scale < 0 || scale > 18) {
+                        napi_throw_range_error(env, nullptr, "scale must be within 0 and 18");
+                        return nullptr;
+                }
+
+                if ((int)cam_slot_type(obj->_cam, slot) != SLOT_COMP_4) {
+                        napi_throw_type_error(env, nullptr, "slot is not a Comp4");
+                        return nullptr;
+                }
+
+                // digits are never dropped silently, neither high ones that
+                // don't fit nor fraction digits below `scale`
+                bool is_signed;
+                int slot_scale;
+                cam_comp_4_t value = cam_get_slot_comp_4(obj->_cam, slot, &is_signed, &slot_scale);
+                bool fits = true;
+                if (slot_scale < scale) {
+                        fits = !mul_overflow(value, pow10_table[scale - slot_scale], &value);
+                } else if (slot_scale > scale) {
+                        // past 18 places every digit of an int64 is dropped
+                        const bool exact = slot_scale - scale > 18 ?
+                                value == 0 : value % pow10_table[slot_scale - scale] == 0;
+                        if (!exact) {
+                                napi_throw_range_error(env, nullptr, "value has more fraction digits than the scale");
+                                return nullptr;
+                        }
+                        value = value == 0 ? 0 : value / pow10_table[slot_scale - scale];
+                }
+
+                napi_value ret;
+                uint8_t *packed;
+                status = napi_create_buffer(env, length, (void**)&packed, &ret);
+                assert(status == napi_ok);
+                if (!fits || !comp3_pack(packed, length, is_signed, value)) {
+                        napi_throw_range_error(env, nullptr, "value doesn't fit the packed decimal");
+                        return nullptr;
+                }
+                return ret;
+        }
+
+        static napi_value SetSlotProgram(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 3;
+                napi_value jsthis, argv[3];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 3);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t slot;
+                status = napi_get_value_int32(env, argv[0], &slot);
+                assert(status == napi_ok);
+
+                program_table_key(env, obj->_programs, argv[1], argv[2]);
+
+                napi_value ret;
+                cam_error_t ec = obj->SetSlotProgramKey(slot);
+                status = napi_create_int32(env, ec, &ret);
+                return ret;
+        }
+
+        // Points `slot` at the program keyed in `_programs.key`, interning
+        // the pair once it resolved. `name` is then set to the interned
+        // pair, valid until the next link.
+        cam_error_t SetSlotProgramKey(int slot, const program_name **name = nullptr)
+        {
+                cam_error_t ec = EnsureLinked();
+                if (ec != CEC_SUCCESS) {
+                        return ec;
+                }
+
+                auto &t = _programs;
+                if (t.generation != _link_generation) {
+                        t.names.clear();
+                        t.generation = _link_generation;
+                }
+
+                auto itr = t.names.find(t.key);
+                if (itr == t.names.end()) {
+                        uint32_t module_len;
+                        memcpy(&module_len, t.key.data(), sizeof(module_len));
+                        program_name pn;
+                        pn.module.assign(t.key, sizeof(module_len), module_len);
+                        pn.program.assign(t.key, sizeof(module_len) + module_len, string::npos);
+                        ec = cam_set_slot_program(_cam, slot, pn.module.c_str(), pn.program.c_str());
+                        if (ec != CEC_SUCCESS) {
+                                return ec;
+                        }
+                        itr = t.names.emplace(t.key, move(pn)).first;
+                } else {
+                        ec = cam_set_slot_program(_cam, slot, itr->second.module.c_str(), itr->second.program.c_str());
+                }
+
+                if (name) {
+                        *name = &itr->second;
+                }
+                return ec;
+        }
+
+        cam_error_t SetSlotProgramName(int slot, const program_name &name)
+        {
+                cam_error_t ec = EnsureLinked();
+                if (ec != CEC_SUCCESS) {
+                        return ec;
+                }
+
+                return cam_set_slot_program(_cam, slot, name.module.c_str(), name.program.c_str());
+        }
+
+        static napi_value SetSlotDisplay(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 2;
+                napi_value jsthis, argv[2];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc >= 1);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t slot;
+                status = napi_get_value_int32(env, argv[0], &slot);
+                assert(status == napi_ok);
+
+                if (argc == 2 && !is_undefined(env, argv[1])) {
+                        size_t display_len, copied_len;
+                        status = napi_get_value_string_utf8(env, argv[1], nullptr, 0, &display_len);
+                        assert(status == napi_ok);
+                        char *str = cam_set_slot_display(obj->_cam, slot, nullptr, display_len);
+                        status = napi_get_value_string_utf8(env, argv[1], str, display_len + 1, &copied_len);
+                        assert(status == napi_ok && display_len == copied_len);
+                } else {
+                        cam_set_slot_display(obj->_cam, slot, "", 1);
+                }
+
+                return nullptr;
+        }
+
+        static napi_value GetSlotComp2(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 1;
+                napi_value jsthis, argv[1];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 1);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t slot;
+                status = napi_get_value_int32(env, argv[0], &slot);
+                assert(status == napi_ok);
+
+                napi_value ret;
+                double value = cam_get_slot_comp_2(obj->_cam, slot);
+                status = napi_create_double(env, value, &ret);
+                assert(status == napi_ok);
+                return ret;
+        }
+
+        static napi_value GetSlotComp4(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 1;
+                napi_value jsthis, argv[1];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 1);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                int32_t slot;
+                status = napi_get_value_int32(env, argv[0], &slot);
+                assert(status == napi_ok);
+
+                bool is_signed;
+                int scale;
+                cam_comp_4_t value = cam_get_slot_comp_4(obj->_cam, slot, &is_signed, &scale);
+
+                return create_comp_4(env, is_signed, scale, value);
+        }
+
+        static napi_value GetSlotDisplay(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
@@ -281,12 +1697,14 @@ private:
                 status = napi_get_value_int32(env, argv[0], &slot);
                 assert(status == napi_ok);
 
+                int length;
                 napi_value ret;
-                status = napi_create_int32(env, cam_slot_type(obj->_cam, slot), &ret);
+                const char *str = cam_get_slot_display(obj->_cam, slot, &length);
+                status = napi_create_string_utf8(env, str, length, &ret);
                 return ret;
         }
 
-        static napi_value SetSlotComp2(napi_env env, napi_callback_info info)
+        static napi_value SlotCopy(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
@@ -299,18 +1717,20 @@ private:
                 status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                int32_t slot;
-                status = napi_get_value_int32(env, argv[0], &slot);
+                int32_t dst_slot;
+                status = napi_get_value_int32(env, argv[0], &dst_slot);
                 assert(status == napi_ok);
 
-                double value;
-                status = napi_get_value_double(env, argv[1], &value);
-                cam_set_slot_comp_2(obj->_cam, slot, value);
+                int32_t src_slot;
+                status = napi_get_value_int32(env, argv[1], &src_slot);
+                assert(status == napi_ok);
+
+                cam_slot_copy(obj->_cam, dst_slot, src_slot);
 
                 return nullptr;
         }
 
-        static napi_value SetSlotComp4(napi_env env, napi_callback_info info)
+        static napi_value Call(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
@@ -323,195 +1743,356 @@ private:
                 status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                int32_t slot;
-                status = napi_get_value_int32(env, argv[0], &slot);
-                assert(status == napi_ok);
-
-                napi_value c4v;
-
-                bool is_signed;
-                status = napi_get_named_property(env, argv[1], "isSigned", &c4v);
-                assert(status == napi_ok);
-                status = napi_get_value_bool(env, c4v, &is_signed);
-                assert(status == napi_ok);
-
-                int scale;
-                status = napi_get_named_property(env, argv[1], "scale", &c4v);
-                assert(status == napi_ok);
-                status = napi_get_value_int32(env, c4v, &scale);
+                int32_t num_usings;
+                status = napi_get_value_int32(env, argv[0], &num_usings);
                 assert(status == napi_ok);
 
-                bool lossless;
-                cam_comp_4_t value;
-                status = napi_get_named_property(env, argv[1], "value", &c4v);
+                int32_t num_returnings;
+                status = napi_get_value_int32(env, argv[1], &num_returnings);
                 assert(status == napi_ok);
-                status = napi_get_value_bigint_int64(env, c4v, &value, &lossless);
-                assert(status == napi_ok && lossless);
 
-                cam_set_slot_comp_4(obj->_cam, slot, is_signed, scale, value);
+                obj->TraceTopLevel();
+                trace_scope scope(obj->_tracer, "vm", "call");
+                ++obj->_call_depth;
+                cam_call(obj->_cam, num_usings, num_returnings);
+                --obj->_call_depth;
 
                 return nullptr;
         }
 
-        static napi_value SetSlotProgram(napi_env env, napi_callback_info info)
+        static napi_value ProtectedCall(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
-                size_t argc = 3;
-                napi_value jsthis, argv[3];
+                size_t argc = 2;
+                napi_value jsthis, argv[2];
                 status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
-                assert(status == napi_ok && argc == 3);
+                assert(status == napi_ok && argc == 2);
 
                 Cam *obj;
                 status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                int32_t slot;
-                status = napi_get_value_int32(env, argv[0], &slot);
+                int32_t num_usings;
+                status = napi_get_value_int32(env, argv[0], &num_usings);
                 assert(status == napi_ok);
 
-                size_t str_len, copied_len;
-
-                status = napi_get_value_string_utf8(env, argv[1], nullptr, 0, &str_len);
+                int32_t num_returnings;
+                status = napi_get_value_int32(env, argv[1], &num_returnings);
                 assert(status == napi_ok);
-                shared_ptr<char> module(new char[str_len + 1]);
-                status = napi_get_value_string_utf8(env, argv[1], module.get(), str_len + 1, &copied_len);
-                assert(status == napi_ok && str_len == copied_len);
 
-                status = napi_get_value_string_utf8(env, argv[2], nullptr, 0, &str_len);
-                assert(status == napi_ok);
-                shared_ptr<char> program(new char[str_len + 1]);
-                status = napi_get_value_string_utf8(env, argv[2], program.get(), str_len + 1, &copied_len);
-                assert(status == napi_ok && str_len == copied_len);
+                obj->TraceTopLevel();
+                trace_scope scope(obj->_tracer, "vm", "protectedCall");
+                ++obj->_call_depth;
+                cam_error_t ec = cam_protected_call(obj->_cam, num_usings, num_returnings);
+                --obj->_call_depth;
 
                 napi_value ret;
-                cam_error_t ec = cam_set_slot_program(obj->_cam, slot, module.get(), program.get());
                 status = napi_create_int32(env, ec, &ret);
                 return ret;
         }
 
-        static napi_value SetSlotDisplay(napi_env env, napi_callback_info info)
+        static napi_value Invoke(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
-                size_t argc = 2;
-                napi_value jsthis, argv[2];
+                size_t argc = 4;
+                napi_value jsthis, argv[4];
                 status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
-                assert(status == napi_ok && argc >= 1);
+                assert(status == napi_ok && argc >= 3);
 
                 Cam *obj;
                 status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                int32_t slot;
-                status = napi_get_value_int32(env, argv[0], &slot);
+                // an array of values, or a buffer of packed ones
+                bool packed_usings;
+                status = napi_is_buffer(env, argv[1], &packed_usings);
                 assert(status == napi_ok);
 
-                if (argc == 2 && !is_undefined(env, argv[1])) {
-                        size_t display_len, copied_len;
-                        status = napi_get_value_string_utf8(env, argv[1], nullptr, 0, &display_len);
+                uint32_t num_usings;
+                const uint8_t *usings = nullptr;
+                size_t usings_len = 0;
+                if (packed_usings) {
+                        status = napi_get_buffer_info(env, argv[1], (void**)&usings, &usings_len);
                         assert(status == napi_ok);
-                        char *str = cam_set_slot_display(obj->_cam, slot, nullptr, display_len);
-                        status = napi_get_value_string_utf8(env, argv[1], str, display_len + 1, &copied_len);
-                        assert(status == napi_ok && display_len == copied_len);
+                        const int count = packed_count(usings, usings_len);
+                        if (count < 0) {
+                                napi_throw_range_error(env, nullptr, "malformed packed usings");
+                                return nullptr;
+                        }
+                        num_usings = (uint32_t)count;
                 } else {
-                        cam_set_slot_display(obj->_cam, slot, "", 1);
+                        status = napi_get_array_length(env, argv[1], &num_usings);
+                        assert(status == napi_ok);
                 }
 
-                return nullptr;
-        }
+                uint32_t num_returnings;
+                status = napi_get_array_length(env, argv[2], &num_returnings);
+                assert(status == napi_ok);
 
-        static napi_value GetSlotComp2(napi_env env, napi_callback_info info)
-        {
-                napi_status status;
+                bool packed_returnings = false;
+                if (argc == 4 && !is_undefined(env, argv[3])) {
+                        status = napi_get_value_bool(env, argv[3], &packed_returnings);
+                        assert(status == napi_ok);
+                }
 
-                size_t argc = 1;
-                napi_value jsthis, argv[1];
-                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
-                assert(status == napi_ok && argc == 1);
+                obj->TraceTopLevel();
+                trace_scope scope(obj->_tracer, "marshal", "invoke");
 
-                Cam *obj;
-                status = napi_unwrap(env, jsthis, (void**)&obj);
+                // same layout as the manual sequence: the program in slot 0
+                // followed by the usings, returnings start back at slot 0
+                cam_ensure_slots(obj->_cam, 1 + max(num_usings, num_returnings));
+
+                napi_value module, program_str;
+                status = napi_get_element(env, argv[0], 0, &module);
+                assert(status == napi_ok);
+                status = napi_get_element(env, argv[0], 1, &program_str);
                 assert(status == napi_ok);
+                program_table_key(env, obj->_programs, module, program_str);
+                const program_name *program = nullptr;
+                cam_error_t ec = obj->SetSlotProgramKey(0, &program);
+
+                if (ec == CEC_SUCCESS) {
+                        auto &cache = obj->_result_cache;
+                        if (cache.generation != obj->_link_generation) {
+                                result_cache_clear(cache);
+                                cache.generation = obj->_link_generation;
+                        }
+
+                        // taken from `program` before marshaling the usings,
+                        // which may run JS that re-links
+                        string key;
+                        if (!cache.cacheable.empty()) {
+                                key = result_cache_program(program->module.c_str(), program->program.c_str());
+                                if (!cache.cacheable.count(key)) {
+                                        key.clear();
+                                }
+                        }
+                        const char *trace_name = obj->TraceName(*program);
+
+                        if (packed_usings) {
+                                set_slots_packed(obj->_cam, 1, usings, usings_len);
+                        } else {
+                                for (uint32_t i = 0; i < num_usings; ++i) {
+                                        napi_value v;
+                                        status = napi_get_element(env, argv[1], i, &v);
+                                        assert(status == napi_ok);
+                                        set_slot_value(env, obj->_cam, 1 + i, v);
+                                }
+                        }
+
+                        const vector<cached_value> *cached = nullptr;
+                        if (!key.empty()) {
+                                key.append((const char*)&num_returnings, sizeof(num_returnings));
+                                for (uint32_t i = 0; i < num_usings && !key.empty(); ++i) {
+                                        if (!result_cache_key_append(key, obj->_cam, 1 + i)) {
+                                                ++cache.uncacheable;
+                                                key.clear();
+                                        }
+                                }
+                                if (!key.empty()) {
+                                        cached = result_cache_find(cache, key);
+                                }
+                        }
+
+                        trace_scope call_scope(obj->_tracer, cached ? "cache" : "vm", trace_name);
+                        if (cached) {
+                                result_cache_replay(*cached, obj->_cam);
+                        } else {
+                                ++obj->_call_depth;
+                                ec = cam_protected_call(obj->_cam, num_usings, num_returnings);
+                                --obj->_call_depth;
+                                if (ec == CEC_SUCCESS && !key.empty()) {
+                                        result_cache_store(cache, key, obj->_cam, num_returnings);
+                                }
+                        }
+                }
 
-                int32_t slot;
-                status = napi_get_value_int32(env, argv[0], &slot);
+                // checked before any is marshaled, so that a mismatch
+                // throws without a half built result
+                vector<int32_t> types(num_returnings);
+                for (uint32_t i = 0; i < num_returnings && ec == CEC_SUCCESS; ++i) {
+                        napi_value v;
+                        status = napi_get_element(env, argv[2], i, &v);
+                        assert(status == napi_ok);
+                        status = napi_get_value_int32(env, v, &types[i]);
+                        assert(status == napi_ok);
+                        // `Unknown` skips the returning
+                        if (types[i] != SLOT_UNKNOWN && types[i] != (int)cam_slot_type(obj->_cam, i)) {
+                                const string msg = "returning " + to_string(i) + " is not of the requested type";
+                                napi_throw_type_error(env, nullptr, msg.c_str());
+                                return nullptr;
+                        }
+                }
+
+                napi_value returnings;
+                if (packed_returnings) {
+                        string out;
+                        for (uint32_t i = 0; i < num_returnings && ec == CEC_SUCCESS; ++i) {
+                                packed_append(out, obj->_cam, i, types[i]);
+                        }
+                        status = napi_create_buffer_copy(env, out.size(), out.data(), nullptr, &returnings);
+                        assert(status == napi_ok);
+                } else {
+                        status = napi_create_array_with_length(env, num_returnings, &returnings);
+                        assert(status == napi_ok);
+                        for (uint32_t i = 0; i < num_returnings && ec == CEC_SUCCESS; ++i) {
+                                status = napi_set_element(env, returnings, i, get_slot_value(env, obj->_cam, i, types[i]));
+                                assert(status == napi_ok);
+                        }
+                }
+
+                napi_value ret, v;
+                status = napi_create_object(env, &ret);
                 assert(status == napi_ok);
 
-                napi_value ret;
-                double value = cam_get_slot_comp_2(obj->_cam, slot);
-                status = napi_create_double(env, value, &ret);
+                status = napi_create_int32(env, ec, &v);
+                assert(status == napi_ok);
+                status = napi_set_named_property(env, ret, "errorCode", v);
+
+                status = napi_set_named_property(env, ret, "returnings", returnings);
                 assert(status == napi_ok);
+
                 return ret;
         }
 
-        static napi_value GetSlotComp4(napi_env env, napi_callback_info info)
+        // Runs the program once per input record: the record is decoded into
+        // the usings, and the returnings are encoded into the output record.
+        static napi_value RunRecords(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
-                size_t argc = 1;
-                napi_value jsthis, argv[1];
+                size_t argc = 6;
+                napi_value jsthis, argv[6];
                 status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
-                assert(status == napi_ok && argc == 1);
+                assert(status == napi_ok && argc == 6);
 
                 Cam *obj;
                 status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                int32_t slot;
-                status = napi_get_value_int32(env, argv[0], &slot);
+                RecordCodec *in_codec  = RecordCodecUnwrap(env, argv[1]);
+                if (!in_codec) {
+                        return nullptr;
+                }
+                RecordCodec *out_codec = RecordCodecUnwrap(env, argv[2]);
+                if (!out_codec) {
+                        return nullptr;
+                }
+
+                uint8_t *input;
+                size_t input_len;
+                status = napi_get_buffer_info(env, argv[3], (void**)&input, &input_len);
                 assert(status == napi_ok);
 
-                bool is_signed;
-                int scale;
-                cam_comp_4_t value = cam_get_slot_comp_4(obj->_cam, slot, &is_signed, &scale);
+                int32_t first_record, count;
+                status = napi_get_value_int32(env, argv[4], &first_record);
+                assert(status == napi_ok);
+                status = napi_get_value_int32(env, argv[5], &count);
+                assert(status == napi_ok);
+                if (first_record < 0 || count < 0) {
+                        napi_throw_range_error(env, nullptr, "first record and count must not be negative");
+                        return nullptr;
+                }
+
+                const int num_usings     = RecordCodecNumFields(in_codec);
+                const int num_returnings = RecordCodecNumFields(out_codec);
+                const size_t out_len = (size_t)count * RecordCodecLength(out_codec);
 
-                napi_value c4v;
-                status = napi_create_object(env, &c4v);
+                napi_value output;
+                uint8_t *out;
+                status = napi_create_buffer(env, out_len, (void**)&out, &output);
                 assert(status == napi_ok);
 
-                napi_value v;
+                obj->TraceTopLevel();
+                trace_scope scope(obj->_tracer, "marshal", "runRecords");
+
+                program_name program;
+                get_program_name(env, argv[0], program);
+                const char *trace_name = obj->TraceName(program);
+
+                cam_error_t ec = CEC_SUCCESS;
+                int processed = 0;
+                for (; processed < count && ec == CEC_SUCCESS; ++processed) {
+                        cam_ensure_slots(obj->_cam, 1 + max(num_usings, num_returnings));
+
+                        ec = obj->SetSlotProgramName(0, program);
+                        if (ec != CEC_SUCCESS) {
+                                break;
+                        }
+
+                        ec = RecordCodecDecode(in_codec, obj->_cam, input, input_len, first_record + processed, 1, 1);
+                        if (ec != CEC_SUCCESS) {
+                                break;
+                        }
+
+                        {
+                                trace_scope call_scope(obj->_tracer, "vm", trace_name);
+                                ++obj->_call_depth;
+                                ec = cam_protected_call(obj->_cam, num_usings, num_returnings);
+                                --obj->_call_depth;
+                        }
+                        if (ec != CEC_SUCCESS) {
+                                break;
+                        }
+
+                        ec = RecordCodecEncode(out_codec, obj->_cam, 0, out, out_len, processed, 1);
+                        if (ec != CEC_SUCCESS) {
+                                break;
+                        }
+                }
+
+                napi_value ret, v;
+                status = napi_create_object(env, &ret);
+                assert(status == napi_ok);
 
-                status = napi_get_boolean(env, is_signed, &v);
+                status = napi_create_int32(env, ec, &v);
                 assert(status == napi_ok);
-                status = napi_set_named_property(env, c4v, "isSigned", v);
+                status = napi_set_named_property(env, ret, "errorCode", v);
 
-                status = napi_create_int32(env, scale, &v);
+                status = napi_create_int32(env, processed, &v);
                 assert(status == napi_ok);
-                status = napi_set_named_property(env, c4v, "scale", v);
+                status = napi_set_named_property(env, ret, "processed", v);
 
-                status = napi_create_bigint_int64(env, value, &v);
+                status = napi_set_named_property(env, ret, "output", output);
                 assert(status == napi_ok);
-                status = napi_set_named_property(env, c4v, "value", v);
 
-                return c4v;
+                return ret;
         }
 
-        static napi_value GetSlotDisplay(napi_env env, napi_callback_info info)
+        static napi_value SetCacheable(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
-                size_t argc = 1;
-                napi_value jsthis, argv[1];
+                size_t argc = 3;
+                napi_value jsthis, argv[3];
                 status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
-                assert(status == napi_ok && argc == 1);
+                assert(status == napi_ok && argc == 3);
 
                 Cam *obj;
                 status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                int32_t slot;
-                status = napi_get_value_int32(env, argv[0], &slot);
+                auto module  = get_value_string(env, argv[0]);
+                auto program = get_value_string(env, argv[1]);
+
+                bool cacheable;
+                status = napi_get_value_bool(env, argv[2], &cacheable);
                 assert(status == napi_ok);
 
-                int length;
-                napi_value ret;
-                const char *str = cam_get_slot_display(obj->_cam, slot, &length);
-                status = napi_create_string_utf8(env, str, length, &ret);
-                return ret;
+                auto &cache = obj->_result_cache;
+                if (cacheable) {
+                        cache.cacheable.insert(result_cache_program(module.get(), program.get()));
+                } else {
+                        cache.cacheable.erase(result_cache_program(module.get(), program.get()));
+                        result_cache_clear(cache);
+                }
+
+                return nullptr;
         }
 
-        static napi_value SlotCopy(napi_env env, napi_callback_info info)
+        static napi_value SetResultCacheLimits(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
@@ -524,67 +2105,158 @@ private:
                 status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                int32_t dst_slot;
-                status = napi_get_value_int32(env, argv[0], &dst_slot);
+                int64_t max_entries;
+                status = napi_get_value_int64(env, argv[0], &max_entries);
                 assert(status == napi_ok);
 
-                int32_t src_slot;
-                status = napi_get_value_int32(env, argv[1], &src_slot);
+                int64_t max_bytes;
+                status = napi_get_value_int64(env, argv[1], &max_bytes);
                 assert(status == napi_ok);
 
-                cam_slot_copy(obj->_cam, dst_slot, src_slot);
+                if (max_entries < 0 || max_bytes < 0) {
+                        napi_throw_range_error(env, nullptr, "cache limits must not be negative");
+                        return nullptr;
+                }
+
+                auto &cache = obj->_result_cache;
+                cache.max_entries = (size_t)max_entries;
+                cache.max_bytes   = (size_t)max_bytes;
+                result_cache_evict(cache);
 
                 return nullptr;
         }
 
-        static napi_value Call(napi_env env, napi_callback_info info)
+        static napi_value ClearResultCache(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
-                size_t argc = 2;
-                napi_value jsthis, argv[2];
-                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
-                assert(status == napi_ok && argc == 2);
+                napi_value jsthis;
+                status = napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr);
+                assert(status == napi_ok);
 
                 Cam *obj;
                 status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                int32_t num_usings;
-                status = napi_get_value_int32(env, argv[0], &num_usings);
+                result_cache_clear(obj->_result_cache);
+
+                return nullptr;
+        }
+
+        static napi_value ResultCacheStats(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                napi_value jsthis;
+                status = napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr);
                 assert(status == napi_ok);
 
-                int32_t num_returnings;
-                status = napi_get_value_int32(env, argv[1], &num_returnings);
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                cam_call(obj->_cam, num_usings, num_returnings);
+                auto &cache = obj->_result_cache;
 
-                return nullptr;
+                napi_value ret, v;
+                status = napi_create_object(env, &ret);
+                assert(status == napi_ok);
+
+                status = napi_create_double(env, (double)cache.hits, &v);
+                assert(status == napi_ok);
+                status = napi_set_named_property(env, ret, "hits", v);
+
+                status = napi_create_double(env, (double)cache.misses, &v);
+                assert(status == napi_ok);
+                status = napi_set_named_property(env, ret, "misses", v);
+
+                status = napi_create_double(env, (double)cache.uncacheable, &v);
+                assert(status == napi_ok);
+                status = napi_set_named_property(env, ret, "uncacheable", v);
+
+                status = napi_create_double(env, (double)cache.entries.size(), &v);
+                assert(status == napi_ok);
+                status = napi_set_named_property(env, ret, "entries", v);
+
+                status = napi_create_double(env, (double)cache.bytes, &v);
+                assert(status == napi_ok);
+                status = napi_set_named_property(env, ret, "bytes", v);
+
+                return ret;
         }
 
-        static napi_value ProtectedCall(napi_env env, napi_callback_info info)
+        static napi_value SetTracing(napi_env env, napi_callback_info info)
         {
                 napi_status status;
 
-                size_t argc = 2;
-                napi_value jsthis, argv[2];
+                size_t argc = 3;
+                napi_value jsthis, argv[3];
                 status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
-                assert(status == napi_ok && argc == 2);
+                assert(status == napi_ok && argc == 3);
 
                 Cam *obj;
                 status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                int32_t num_usings;
-                status = napi_get_value_int32(env, argv[0], &num_usings);
+                auto &t = obj->_tracer;
+
+                status = napi_get_value_bool(env, argv[0], &t.enabled);
                 assert(status == napi_ok);
+                t.tid = current_thread_id();
+
+                uint32_t capacity, sample_every;
+                status = napi_get_value_uint32(env, argv[1], &capacity);
+                assert(status == napi_ok && capacity > 0);
+                status = napi_get_value_uint32(env, argv[2], &sample_every);
+                assert(status == napi_ok && sample_every > 0);
+
+                if (capacity != t.ring.size()) {
+                        t.ring.assign(capacity, trace_event());
+                        t.next = 0;
+                        t.recorded = 0;
+                }
+                t.sample_every = sample_every;
+                t.sampled = true;
 
-                int32_t num_returnings;
-                status = napi_get_value_int32(env, argv[1], &num_returnings);
+                return nullptr;
+        }
+
+        static napi_value TraceDump(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                napi_value jsthis;
+                status = napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr);
+                assert(status == napi_ok);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                const string json = tracer_dump(obj->_tracer);
+
+                napi_value ret;
+                status = napi_create_string_utf8(env, json.c_str(), json.size(), &ret);
+                assert(status == napi_ok);
+                return ret;
+        }
+
+        static napi_value TraceClear(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                napi_value jsthis;
+                status = napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr);
+                assert(status == napi_ok);
+
+                Cam *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
                 assert(status == napi_ok);
 
-                cam_protected_call(obj->_cam, num_usings, num_returnings);
+                obj->_tracer.next = 0;
+                obj->_tracer.recorded = 0;
+                if (obj->_call_depth == 0) {
+                        obj->_tracer.names.clear();
+                }
 
                 return nullptr;
         }
@@ -593,7 +2265,17 @@ private:
         napi_ref _wrapper;
         struct cam_s *_cam;
         vector<shared_ptr<ForeignProgram>> _foreign_programs;
+        vector<cam_foreign_program_t> _native_programs;
+        indexed_files *_indexed_files;
+        sequential_files *_sequential_files;
         chunk_allocator _chunk_allocator;
+        program_table _programs;
+        bool _lazy_link;
+        bool _link_dirty;
+        int _call_depth;
+        int _link_generation;
+        result_cache _result_cache;
+        tracer _tracer;
 
 public:
         static void Init(napi_env env, napi_value exports)
@@ -602,21 +2284,34 @@ public:
 
                 const napi_property_descriptor props[] = {
                         DECLARE_NAPI_METHOD("addChunkBuffer", &AddChunkBuffer),
+                        DECLARE_NAPI_METHOD("addChunksAsync", &AddChunksAsync),
                         DECLARE_NAPI_METHOD("addForeign",     &AddForeign),
                         DECLARE_NAPI_METHOD("link",           &Link),
+                        DECLARE_NAPI_METHOD("setLazyLink",    &SetLazyLink),
                         DECLARE_NAPI_METHOD("ensureSlots",    &EnsureSlots),
                         DECLARE_NAPI_METHOD("numSlots",       &NumSlots),
                         DECLARE_NAPI_METHOD("slotType",       &SlotType),
                         DECLARE_NAPI_METHOD("setSlotComp2",   &SetSlotComp2),
                         DECLARE_NAPI_METHOD("setSlotComp4",   &SetSlotComp4),
+                        DECLARE_NAPI_METHOD("setSlotComp3",   &SetSlotComp3),
                         DECLARE_NAPI_METHOD("setSlotProgram", &SetSlotProgram),
                         DECLARE_NAPI_METHOD("setSlotDisplay", &SetSlotDisplay),
                         DECLARE_NAPI_METHOD("getSlotComp2",   &GetSlotComp2),
                         DECLARE_NAPI_METHOD("getSlotComp4",   &GetSlotComp4),
+                        DECLARE_NAPI_METHOD("getSlotComp3",   &GetSlotComp3),
                         DECLARE_NAPI_METHOD("getSlotDisplay", &GetSlotDisplay),
                         DECLARE_NAPI_METHOD("slotCopy",       &SlotCopy),
                         DECLARE_NAPI_METHOD("call",           &Call),
-                        DECLARE_NAPI_METHOD("protectedCall",  &ProtectedCall)
+                        DECLARE_NAPI_METHOD("protectedCall",  &ProtectedCall),
+                        DECLARE_NAPI_METHOD("invoke",         &Invoke),
+                        DECLARE_NAPI_METHOD("runRecords",     &RunRecords),
+                        DECLARE_NAPI_METHOD("setCacheable",   &SetCacheable),
+                        DECLARE_NAPI_METHOD("setResultCacheLimits", &SetResultCacheLimits),
+                        DECLARE_NAPI_METHOD("clearResultCache", &ClearResultCache),
+                        DECLARE_NAPI_METHOD("resultCacheStats", &ResultCacheStats),
+                        DECLARE_NAPI_METHOD("setTracing",     &SetTracing),
+                        DECLARE_NAPI_METHOD("traceDump",      &TraceDump),
+                        DECLARE_NAPI_METHOD("traceClear",     &TraceClear)
                 };
 
                 const size_t num_props = sizeof(props) / sizeof(props[0]);
@@ -634,6 +2329,36 @@ public:
         {
                 ((Cam*)obj)->~Cam();
         }
+
+        // nullptr with a pending TypeError if `jsobj` isn't a Cam
+        static Cam* UnwrapCam(napi_env env, napi_value jsobj)
+        {
+                napi_status status;
+
+                bool is_cam = false;
+                napi_valuetype t;
+                status = napi_typeof(env, jsobj, &t);
+                assert(status == napi_ok);
+                if (t == napi_object) {
+                        status = napi_check_object_type_tag(env, jsobj, &cam_type_tag, &is_cam);
+                        assert(status == napi_ok);
+                }
+                if (!is_cam) {
+                        napi_throw_type_error(env, nullptr, "expected a Cam");
+                        return nullptr;
+                }
+
+                Cam *obj;
+                status = napi_unwrap(env, jsobj, (void**)&obj);
+                assert(status == napi_ok);
+                return obj;
+        }
+
+        static struct cam_s* Unwrap(napi_env env, napi_value jsobj)
+        {
+                Cam *obj = UnwrapCam(env, jsobj);
+                return obj ? obj->_cam : nullptr;
+        }
 };
 
 void CamInit(napi_env env, napi_value exports)
@@ -641,4 +2366,10 @@ void CamInit(napi_env env, napi_value exports)
         Cam::Init(env, exports);
 }
 
+// nullptr with a pending TypeError if `cam` isn't a Cam
+struct cam_s* CamUnwrap(napi_env env, napi_value cam)
+{
+        return Cam::Unwrap(env, cam);
+}
+
 } } // namespace cam::native
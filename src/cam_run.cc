@@ -0,0 +1,277 @@
+#include "native_common.h"
+#include <cam/memory.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+using namespace cam::native;
+
+static const size_t STDOUT_BUFFER_SIZE = 1 << 20;
+
+// Chunks are mapped read only and unmapped when the instance drops them.
+struct mapped_allocator
+{
+        // `aif` must be at the head
+        struct cam_alloc_if_s aif;
+        map<const void*, size_t> mappings;
+        size_t bytes;
+};
+
+static void mapped_allocator_aif_dealloc(struct cam_alloc_s *a, void *p)
+{
+        auto ma = (mapped_allocator*)a;
+        auto itr = ma->mappings.find(p);
+        assert(itr != ma->mappings.end());
+        munmap(p, itr->second);
+        ma->mappings.erase(itr);
+}
+
+static void mapped_allocator_init(mapped_allocator &a)
+{
+        a.aif.malloc  = nullptr;
+        a.aif.dealloc = &mapped_allocator_aif_dealloc;
+        a.bytes = 0;
+}
+
+static const void* map_chunk(mapped_allocator &a, const char *path)
+{
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                return nullptr;
+        }
+
+        // prefault the whole chunk where the platform can
+#ifdef MAP_POPULATE
+        const int flags = MAP_PRIVATE | MAP_POPULATE;
+#else
+        const int flags = MAP_PRIVATE;
+#endif
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                p = mmap(nullptr, st.st_size, PROT_READ, flags, fd, 0);
+        }
+        close(fd);
+        if (p == MAP_FAILED) {
+                return nullptr;
+        }
+
+        a.mappings[p] = st.st_size;
+        a.bytes += st.st_size;
+        return p;
+}
+
+// CALL 'SYSTEM:CONSOLE-WRITE' USING text, through a large stdio buffer
+// flushed at exit instead of a write per call.
+static void console_write(struct cam_s *cam, int num_usings, void *)
+{
+        if (num_usings < 1) {
+                return;
+        }
+
+        int length;
+        const char *str = cam_get_slot_display(cam, -1, &length);
+        fwrite(str, 1, length, stdout);
+}
+
+static char system_module[]      = "SYSTEM";
+static char console_write_name[] = "CONSOLE-WRITE";
+
+static double elapsed_ms(chrono::steady_clock::time_point since)
+{
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+}
+
+// Only a plain decimal literal, e.g. "-12.50", is a number, anything
+// strtod would also take (hex, exponents, inf, nan, leading blanks) stays
+// text.
+static bool is_decimal(const char *arg)
+{
+        const char *p = arg + (*arg == '-');
+        bool digits = false, point = false;
+        for (; *p; ++p) {
+                if (*p >= '0' && *p <= '9') {
+                        digits = true;
+                } else if (*p == '.' && !point) {
+                        point = true;
+                } else {
+                        return false;
+                }
+        }
+        return digits;
+}
+
+// Decimal literals become Comp2, anything else Display.
+static void set_argument(struct cam_s *cam, int slot, const char *arg)
+{
+        if (is_decimal(arg)) {
+                cam_set_slot_comp_2(cam, slot, strtod(arg, nullptr));
+        } else {
+                cam_set_slot_display(cam, slot, arg, (int)strlen(arg));
+        }
+}
+
+static void usage()
+{
+        fprintf(stderr,
+                "usage: cam-run [-t] -e MODULE:PROGRAM CHUNK... [-- ARG...]\n"
+                "  -e  entry program\n"
+                "  -t  print load, link and run times to stderr\n"
+                "an ARG that is a plain decimal number is passed as Comp2, others as Display\n");
+}
+
+struct options
+{
+        bool timing;
+        string entry;
+        string module;
+        string program;
+        vector<const char*> chunks;
+        vector<const char*> args;
+};
+
+// Loads, links and runs the entry program, the caller drops `cam` and what
+// was added to it whatever this returns.
+static int run(
+        struct cam_s *cam, const options &o, mapped_allocator &alloc, vector<cam_foreign_program_t> &programs,
+        chrono::steady_clock::time_point started)
+{
+        cam_error_t ec;
+        for (size_t i = 0; i < o.chunks.size(); ++i) {
+                const void *chunk = map_chunk(alloc, o.chunks[i]);
+                if (!chunk) {
+                        fprintf(stderr, "cam-run: can't map %s\n", o.chunks[i]);
+                        return 1;
+                }
+                ec = cam_add_chunk(cam, chunk, (struct cam_alloc_s*)&alloc);
+                if (ec != CEC_SUCCESS) {
+                        fprintf(stderr, "cam-run: bad chunk %s: code = %d\n", o.chunks[i], ec);
+                        return 1;
+                }
+        }
+        const double load_ms = elapsed_ms(started);
+
+        for (size_t i = 0; i < programs.size(); ++i) {
+                ec = cam_add_foreign(cam, &programs[i]);
+                if (ec != CEC_SUCCESS) {
+                        fprintf(stderr, "cam-run: can't add %s:%s: code = %d\n", programs[i].module, programs[i].program, ec);
+                        return 1;
+                }
+        }
+
+        const auto link_started = chrono::steady_clock::now();
+        ec = cam_link(cam);
+        const double link_ms = elapsed_ms(link_started);
+        if (ec != CEC_SUCCESS) {
+                fprintf(stderr, "cam-run: failed to link: code = %d\n", ec);
+                return 1;
+        }
+
+        // same layout as `Cam.invoke`: the program in slot 0 followed by
+        // the usings
+        const int num_usings = (int)o.args.size();
+        cam_ensure_slots(cam, 1 + num_usings);
+        ec = cam_set_slot_program(cam, 0, o.module.c_str(), o.program.c_str());
+        if (ec != CEC_SUCCESS) {
+                fprintf(stderr, "cam-run: no program %s: code = %d\n", o.entry.c_str(), ec);
+                return 1;
+        }
+        for (int i = 0; i < num_usings; ++i) {
+                set_argument(cam, 1 + i, o.args[i]);
+        }
+
+        const auto run_started = chrono::steady_clock::now();
+        ec = cam_protected_call(cam, num_usings, 0);
+        const double run_ms = elapsed_ms(run_started);
+        fflush(stdout);
+
+        if (ec != CEC_SUCCESS) {
+                fprintf(stderr, "cam-run: %s failed: code = %d\n", o.entry.c_str(), ec);
+        }
+
+        if (o.timing) {
+                fprintf(stderr,
+                        "cam-run: %zu chunk(s), %zu bytes; load %.3f ms, link %.3f ms, run %.3f ms, total %.3f ms\n",
+                        o.chunks.size(), alloc.bytes, load_ms, link_ms, run_ms, elapsed_ms(started));
+        }
+
+        return ec == CEC_SUCCESS ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+        const auto started = chrono::steady_clock::now();
+
+        options o;
+        o.timing = false;
+        for (int i = 1; i < argc; ++i) {
+                if (!strcmp(argv[i], "-t")) {
+                        o.timing = true;
+                } else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+                        o.entry = argv[++i];
+                } else if (!strcmp(argv[i], "--")) {
+                        o.args.assign(argv + i + 1, argv + argc);
+                        break;
+                } else if (argv[i][0] == '-') {
+                        usage();
+                        return 2;
+                } else {
+                        o.chunks.push_back(argv[i]);
+                }
+        }
+
+        const size_t sep = o.entry.find(':');
+        if (sep == string::npos || o.chunks.empty()) {
+                usage();
+                return 2;
+        }
+        o.module  = o.entry.substr(0, sep);
+        o.program = o.entry.substr(sep + 1);
+
+        setvbuf(stdout, nullptr, _IOFBF, STDOUT_BUFFER_SIZE);
+
+        cam_error_t ec;
+        struct cam_s *cam = cam_init(&ec);
+        assert(ec == CEC_SUCCESS);
+
+        mapped_allocator alloc;
+        mapped_allocator_init(alloc);
+
+        // outlive the instance
+        indexed_files *indexed = indexed_files_new();
+        sequential_files *files = sequential_files_new();
+        vector<cam_foreign_program_t> programs;
+        SortPrograms          (programs);
+        IndexedFilePrograms   (programs, indexed);
+        SequentialFilePrograms(programs, files);
+
+        cam_foreign_program_t console;
+        console.module  = system_module;
+        console.program = console_write_name;
+        console.func    = &console_write;
+        console.ud      = nullptr;
+        programs.push_back(console);
+
+        const int rc = run(cam, o, alloc, programs, started);
+
+        // files the program left open are flushed or closed, and their
+        // threads joined, before exit, whether it ran or not
+        cam_drop(cam);
+        indexed_files_drop(indexed);
+        sequential_files_drop(files);
+        fflush(stdout);
+        return rc;
+}
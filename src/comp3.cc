@@ -0,0 +1,97 @@
+#include "native_common.h"
+
+namespace cam { namespace native {
+
+const int64_t pow10_table[19] = {
+        1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL,
+        100000000LL, 1000000000LL, 10000000000LL, 100000000000LL,
+        1000000000000LL, 10000000000000LL, 100000000000000LL,
+        1000000000000000LL, 10000000000000000LL, 100000000000000000LL,
+        1000000000000000000LL
+};
+
+struct comp3_tables
+{
+        // byte -> 10 * high nibble + low nibble, 0xFF if either isn't a digit
+        uint8_t digit_pairs[256];
+        // two digits -> byte
+        uint8_t packed_pairs[100];
+};
+
+static constexpr comp3_tables make_tables()
+{
+        comp3_tables t = {};
+
+        for (int b = 0; b < 256; ++b) {
+                const int hi = b >> 4, lo = b & 0x0F;
+                t.digit_pairs[b] = (hi > 9 || lo > 9) ? 0xFF : (uint8_t)(hi * 10 + lo);
+        }
+
+        for (int d = 0; d < 100; ++d) {
+                t.packed_pairs[d] = (uint8_t)(((d / 10) << 4) | (d % 10));
+        }
+
+        return t;
+}
+
+// built at compile time, so usable from static initializers of other files
+static constexpr comp3_tables tables = make_tables();
+
+// Unpacks `n` (at most 10) bytes of packed decimal, false on a bad digit or
+// sign nibble, or if the value doesn't fit. An F sign nibble is unsigned.
+bool comp3_unpack(const uint8_t *p, int n, bool *is_signed, cam_comp_4_t *value)
+{
+        if (n < 1 || n > 10) {
+                return false;
+        }
+
+        uint64_t v = 0;
+        for (int i = 0; i < n - 1; ++i) {
+                const uint8_t pair = tables.digit_pairs[p[i]];
+                if (pair == 0xFF) {
+                        return false;
+                }
+                v = v * 100 + pair;
+        }
+
+        const int last = p[n - 1] >> 4;
+        const int sign = p[n - 1] & 0x0F;
+        if (last > 9 || sign < 0x0A) {
+                return false;
+        }
+        v = v * 10 + last;
+
+        if (v > (uint64_t)INT64_MAX) {
+                return false;
+        }
+
+        const bool negative = sign == 0x0B || sign == 0x0D;
+        *is_signed = sign != 0x0F;
+        *value = negative ? -(cam_comp_4_t)v : (cam_comp_4_t)v;
+        return true;
+}
+
+// Packs `value` into `n` (at most 10) bytes, unsigned values get an F sign
+// nibble. False if it doesn't fit, i.e. it has more than 2n - 1 digits or
+// is negative and unsigned, the bytes are then left undefined.
+bool comp3_pack(uint8_t *p, int n, bool is_signed, cam_comp_4_t value)
+{
+        const bool negative = value < 0;
+        if (negative && !is_signed) {
+                return false;
+        }
+        uint64_t v = negative ? 0 - (uint64_t)value : (uint64_t)value;
+
+        const int sign = is_signed ? (negative ? 0x0D : 0x0C) : 0x0F;
+        p[n - 1] = (uint8_t)(((v % 10) << 4) | sign);
+        v /= 10;
+
+        for (int i = n - 2; i >= 0; --i) {
+                p[i] = tables.packed_pairs[v % 100];
+                v /= 100;
+        }
+
+        return v == 0;
+}
+
+} } // namespace cam::native
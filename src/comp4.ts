@@ -0,0 +1,105 @@
+const native = require('bindings')('cam-native')
+import { Comp4 } from './cam'
+
+// A column of Comp4 values sharing the same scale and sign, backed by a
+// BigInt64Array so that batch kernels run natively over the whole column.
+// Kernels throw a RangeError at the first row whose result doesn't fit in
+// 64 bits, and for mismatched column lengths or scales outside 0..18.
+export class Comp4Column
+{
+        scale: number
+        isSigned: boolean
+        values: BigInt64Array
+
+        constructor(isSigned: boolean, scale: number, values: BigInt64Array | number)
+        {
+                this.isSigned = isSigned
+                this.scale    = scale
+                this.values   = typeof values === 'number' ? new BigInt64Array(values) : values
+        }
+
+        // Unpacks `packed`, a run of COMP-3 values `length` bytes each.
+        // Throws a RangeError if `length` isn't within 1 and 10.
+        static fromComp3(packed: Buffer, length: number, scale: number, isSigned = true): Comp4Column
+        {
+                const column = new Comp4Column(isSigned, scale, Math.floor(packed.length / length))
+                const bad = native.comp3Unpack(column.values, packed, length)
+                if (bad !== -1) {
+                        throw new Error('bad packed decimal at index ' + bad)
+                }
+                return column
+        }
+
+        // Throws a RangeError if `length` isn't within 1 and 10, if a value
+        // has more than `2 * length - 1` digits, or is negative in an
+        // unsigned column.
+        toComp3(length: number): Buffer
+        {
+                const packed = Buffer.alloc(this.length * length)
+                native.comp3Pack(packed, length, this.values, this.isSigned)
+                return packed
+        }
+
+        get length(): number
+        {
+                return this.values.length
+        }
+
+        at(i: number): Comp4
+        {
+                return new Comp4(this.isSigned, this.scale, this.values[i])
+        }
+
+        rescale(scale: number, rounded = true): Comp4Column
+        {
+                const dst = new Comp4Column(this.isSigned, scale, this.length)
+                native.comp4Rescale(dst.values, dst.scale, this.values, this.scale, rounded)
+                return dst
+        }
+
+        add(other: Comp4Column, scale = Math.max(this.scale, other.scale)): Comp4Column
+        {
+                const dst = new Comp4Column(this.isSigned || other.isSigned, scale, this.length)
+                native.comp4Add(dst.values, dst.scale, this.values, this.scale, other.values, other.scale)
+                return dst
+        }
+
+        sub(other: Comp4Column, scale = Math.max(this.scale, other.scale)): Comp4Column
+        {
+                const dst = new Comp4Column(true, scale, this.length)
+                native.comp4Sub(dst.values, dst.scale, this.values, this.scale, other.values, other.scale)
+                return dst
+        }
+
+        mul(other: Comp4Column, scale = this.scale + other.scale): Comp4Column
+        {
+                const dst = new Comp4Column(this.isSigned || other.isSigned, scale, this.length)
+                native.comp4Mul(dst.values, dst.scale, this.values, this.scale, other.values, other.scale)
+                return dst
+        }
+
+        // -1, 0 or 1 per row
+        compare(other: Comp4Column): Int8Array
+        {
+                const dst = new Int8Array(this.length)
+                native.comp4Compare(dst, this.values, this.scale, other.values, other.scale)
+                return dst
+        }
+
+        sum(): Comp4
+        {
+                return new Comp4(this.isSigned, this.scale, native.comp4Sum(this.values))
+        }
+
+        min(): Comp4 | undefined
+        {
+                const value = native.comp4Min(this.values)
+                return value === undefined ? undefined : new Comp4(this.isSigned, this.scale, value)
+        }
+
+        max(): Comp4 | undefined
+        {
+                const value = native.comp4Max(this.values)
+                return value === undefined ? undefined : new Comp4(this.isSigned, this.scale, value)
+        }
+}
@@ -0,0 +1,648 @@
+#include "native_common.h"
+
+#include <node_api.h>
+
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <string>
+
+// __builtin_cpu_supports and the target attribute are GCC and Clang only,
+// other compilers build the scalar kernels alone
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(_MSC_VER) && (defined(__x86_64__) || defined(__i386__))
+#define CAM_COMP4_AVX2 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+#define DECLARE_NAPI_METHOD(name, func) { name, 0, func, 0, 0, 0, napi_default, 0 }
+
+namespace cam { namespace native {
+
+// Moves `v` from `from` to `to` decimal places, dropped digits are either
+// truncated or rounded half away from zero. False if the result doesn't
+// fit.
+static inline bool rescale(int64_t v, int from, int to, bool rounded, int64_t *r)
+{
+        if (to >= from) {
+                return !mul_overflow(v, pow10_table[to - from], r);
+        }
+
+        const int64_t d = pow10_table[from - to];
+        const int64_t q = v / d;
+        if (!rounded) {
+                *r = q;
+                return true;
+        }
+
+        const int64_t m = v % d;
+        if (m >= d - m) {
+                *r = q + 1;
+        } else if (-m >= d + m) {
+                *r = q - 1;
+        } else {
+                *r = q;
+        }
+        return true;
+}
+
+// -1, 0 or 1 as `x` compares to `y * m`, exact even where the product
+// doesn't fit: it is then out of the range of `x`.
+static inline int8_t compare_scaled(int64_t x, int64_t y, int64_t m)
+{
+        int64_t ym;
+        if (mul_overflow(y, m, &ym)) {
+                return y > 0 ? -1 : 1;
+        }
+        return (int8_t)((x > ym) - (x < ym));
+}
+
+static void throw_out_of_range(napi_env env, size_t i)
+{
+        const string msg = "Comp4 value out of range at index " + to_string(i);
+        napi_throw_range_error(env, nullptr, msg.c_str());
+}
+
+#ifdef CAM_COMP4_AVX2
+
+static bool has_avx2()
+{
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+}
+
+// The vector kernels only detect overflow, the caller redoes the work in
+// the scalar path to report where (or, for sums, to tell whether the
+// total is still in range). A lane overflowed if the sign of its
+// result differs from the signs of both operands (add) or from the sign
+// of the minuend but not of the subtrahend (sub).
+
+__attribute__((target("avx2")))
+static bool add_avx2(int64_t *dst, const int64_t *a, const int64_t *b, size_t n)
+{
+        __m256i overflow = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+                __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+                __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+                __m256i vr = _mm256_add_epi64(va, vb);
+                overflow = _mm256_or_si256(overflow,
+                        _mm256_and_si256(_mm256_xor_si256(va, vr), _mm256_xor_si256(vb, vr)));
+                _mm256_storeu_si256((__m256i*)(dst + i), vr);
+        }
+        if (_mm256_movemask_pd(_mm256_castsi256_pd(overflow))) {
+                return false;
+        }
+        for (; i < n; ++i) {
+                if (add_overflow(a[i], b[i], dst + i)) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+__attribute__((target("avx2")))
+static bool sub_avx2(int64_t *dst, const int64_t *a, const int64_t *b, size_t n)
+{
+        __m256i overflow = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+                __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+                __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+                __m256i vr = _mm256_sub_epi64(va, vb);
+                overflow = _mm256_or_si256(overflow,
+                        _mm256_and_si256(_mm256_xor_si256(va, vb), _mm256_xor_si256(va, vr)));
+                _mm256_storeu_si256((__m256i*)(dst + i), vr);
+        }
+        if (_mm256_movemask_pd(_mm256_castsi256_pd(overflow))) {
+                return false;
+        }
+        for (; i < n; ++i) {
+                if (sub_overflow(a[i], b[i], dst + i)) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+__attribute__((target("avx2")))
+static bool sum_avx2(const int64_t *a, size_t n, int64_t *sum)
+{
+        __m256i acc = _mm256_setzero_si256();
+        __m256i overflow = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+                __m256i v = _mm256_loadu_si256((const __m256i*)(a + i));
+                __m256i r = _mm256_add_epi64(acc, v);
+                overflow = _mm256_or_si256(overflow,
+                        _mm256_and_si256(_mm256_xor_si256(acc, r), _mm256_xor_si256(v, r)));
+                acc = r;
+        }
+        if (_mm256_movemask_pd(_mm256_castsi256_pd(overflow))) {
+                return false;
+        }
+
+        int64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+        *sum = lanes[0];
+        for (int l = 1; l < 4; ++l) {
+                if (add_overflow(*sum, lanes[l], sum)) {
+                        return false;
+                }
+        }
+        for (; i < n; ++i) {
+                if (add_overflow(*sum, a[i], sum)) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+// `n` must not be zero
+__attribute__((target("avx2")))
+static int64_t min_max_avx2(const int64_t *a, size_t n, bool is_max)
+{
+        size_t i = 0;
+        int64_t m = a[0];
+        if (n >= 4) {
+                __m256i acc = _mm256_loadu_si256((const __m256i*)a);
+                for (i = 4; i + 4 <= n; i += 4) {
+                        __m256i v = _mm256_loadu_si256((const __m256i*)(a + i));
+                        __m256i gt = is_max ? _mm256_cmpgt_epi64(v, acc) : _mm256_cmpgt_epi64(acc, v);
+                        acc = _mm256_blendv_epi8(acc, v, gt);
+                }
+
+                int64_t lanes[4];
+                _mm256_storeu_si256((__m256i*)lanes, acc);
+                m = lanes[0];
+                for (int l = 1; l < 4; ++l) {
+                        m = is_max ? max(m, lanes[l]) : min(m, lanes[l]);
+                }
+        }
+        for (; i < n; ++i) {
+                m = is_max ? max(m, a[i]) : min(m, a[i]);
+        }
+        return m;
+}
+
+#endif // CAM_COMP4_AVX2
+
+// False with a pending TypeError if `v` isn't a typed array of `type`.
+static bool get_typed_array(napi_env env, napi_value v, napi_typedarray_type type, void **values, size_t *length)
+{
+        napi_status status;
+
+        bool is_typed_array;
+        status = napi_is_typedarray(env, v, &is_typed_array);
+        assert(status == napi_ok);
+
+        napi_typedarray_type t;
+        if (is_typed_array) {
+                status = napi_get_typedarray_info(env, v, &t, length, values, nullptr, nullptr);
+                assert(status == napi_ok);
+        }
+        if (!is_typed_array || t != type) {
+                napi_throw_type_error(env, nullptr,
+                        type == napi_bigint64_array ? "expected a BigInt64Array" : "expected an Int8Array");
+                return false;
+        }
+
+        return true;
+}
+
+static bool get_column(napi_env env, napi_value v, int64_t **values, size_t *length)
+{
+        return get_typed_array(env, v, napi_bigint64_array, (void**)values, length);
+}
+
+// -1 with a pending RangeError if out of 0..18
+static int get_scale(napi_env env, napi_value v)
+{
+        napi_status status;
+
+        int32_t scale;
+        status = napi_get_value_int32(env, v, &scale);
+        assert(status == napi_ok);
+        if (scale < 0 || scale > 18) {
+                napi_throw_range_error(env, nullptr, "Comp4 scale must be within 0 and 18");
+                return -1;
+        }
+
+        return scale;
+}
+
+static napi_value Rescale(napi_env env, napi_callback_info info)
+{
+        napi_status status;
+
+        size_t argc = 5;
+        napi_value argv[5];
+        status = napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+        assert(status == napi_ok && argc == 5);
+
+        int64_t *dst, *src;
+        size_t n, src_n;
+        if (!get_column(env, argv[0], &dst, &n) || !get_column(env, argv[2], &src, &src_n)) {
+                return nullptr;
+        }
+        const int dst_scale = get_scale(env, argv[1]);
+        if (dst_scale < 0) {
+                return nullptr;
+        }
+        const int src_scale = get_scale(env, argv[3]);
+        if (src_scale < 0) {
+                return nullptr;
+        }
+        if (n != src_n) {
+                napi_throw_range_error(env, nullptr, "Comp4 column lengths differ");
+                return nullptr;
+        }
+
+        bool rounded;
+        status = napi_get_value_bool(env, argv[4], &rounded);
+        assert(status == napi_ok);
+
+        for (size_t i = 0; i < n; ++i) {
+                if (!rescale(src[i], src_scale, dst_scale, rounded, dst + i)) {
+                        throw_out_of_range(env, i);
+                        return nullptr;
+                }
+        }
+
+        return nullptr;
+}
+
+enum binary_kernel
+{
+        KERNEL_ADD,
+        KERNEL_SUB,
+        KERNEL_MUL
+};
+
+// dst = round(a op b) at dst scale, inputs are aligned to the larger of
+// their scales (the sum of them for mul) before rounding. Throws a
+// RangeError at the first row that doesn't fit.
+static napi_value binary(napi_env env, napi_callback_info info, binary_kernel kernel)
+{
+        napi_status status;
+
+        size_t argc = 6;
+        napi_value argv[6];
+        status = napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+        assert(status == napi_ok && argc == 6);
+
+        int64_t *dst, *a, *b;
+        size_t n, a_n, b_n;
+        if (!get_column(env, argv[0], &dst, &n) ||
+            !get_column(env, argv[2], &a, &a_n) ||
+            !get_column(env, argv[4], &b, &b_n)) {
+                return nullptr;
+        }
+        int scales[3];
+        for (int i = 0; i < 3; ++i) {
+                // a second throw would be lost, stop at the first
+                if ((scales[i] = get_scale(env, argv[1 + 2 * i])) < 0) {
+                        return nullptr;
+                }
+        }
+        const int dst_scale = scales[0];
+        const int a_scale   = scales[1];
+        const int b_scale   = scales[2];
+        if (n != a_n || n != b_n) {
+                napi_throw_range_error(env, nullptr, "Comp4 column lengths differ");
+                return nullptr;
+        }
+
+        if (kernel == KERNEL_MUL) {
+                const int scale = a_scale + b_scale;
+                if (scale - dst_scale > 18) {
+                        napi_throw_range_error(env, nullptr, "Comp4 product scale too far above the result scale");
+                        return nullptr;
+                }
+                for (size_t i = 0; i < n; ++i) {
+                        int64_t r;
+                        if (mul_overflow(a[i], b[i], &r) ||
+                            !rescale(r, scale, dst_scale, true, dst + i)) {
+                                throw_out_of_range(env, i);
+                                return nullptr;
+                        }
+                }
+                return nullptr;
+        }
+
+        if (a_scale == dst_scale && b_scale == dst_scale) {
+#ifdef CAM_COMP4_AVX2
+                if (has_avx2()) {
+                        const bool ok = kernel == KERNEL_ADD ? add_avx2(dst, a, b, n) : sub_avx2(dst, a, b, n);
+                        if (ok) {
+                                return nullptr;
+                        }
+                }
+#endif
+                for (size_t i = 0; i < n; ++i) {
+                        const bool overflow = kernel == KERNEL_ADD ?
+                                add_overflow(a[i], b[i], dst + i) :
+                                sub_overflow(a[i], b[i], dst + i);
+                        if (overflow) {
+                                throw_out_of_range(env, i);
+                                return nullptr;
+                        }
+                }
+                return nullptr;
+        }
+
+        const int scale = max(a_scale, b_scale);
+        const int64_t am = pow10_table[scale - a_scale];
+        const int64_t bm = pow10_table[scale - b_scale];
+        for (size_t i = 0; i < n; ++i) {
+                int64_t x, y, r;
+                const bool overflow =
+                        mul_overflow(a[i], am, &x) ||
+                        mul_overflow(b[i], bm, &y) ||
+                        (kernel == KERNEL_ADD ? add_overflow(x, y, &r) : sub_overflow(x, y, &r)) ||
+                        !rescale(r, scale, dst_scale, true, dst + i);
+                if (overflow) {
+                        throw_out_of_range(env, i);
+                        return nullptr;
+                }
+        }
+        return nullptr;
+}
+
+static napi_value Add(napi_env env, napi_callback_info info)
+{
+        return binary(env, info, KERNEL_ADD);
+}
+
+static napi_value Sub(napi_env env, napi_callback_info info)
+{
+        return binary(env, info, KERNEL_SUB);
+}
+
+static napi_value Mul(napi_env env, napi_callback_info info)
+{
+        return binary(env, info, KERNEL_MUL);
+}
+
+static napi_value Compare(napi_env env, napi_callback_info info)
+{
+        napi_status status;
+
+        size_t argc = 5;
+        napi_value argv[5];
+        status = napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+        assert(status == napi_ok && argc == 5);
+
+        int8_t *dst;
+        int64_t *a, *b;
+        size_t n, a_n, b_n;
+        if (!get_typed_array(env, argv[0], napi_int8_array, (void**)&dst, &n) ||
+            !get_column(env, argv[1], &a, &a_n) ||
+            !get_column(env, argv[3], &b, &b_n)) {
+                return nullptr;
+        }
+        const int a_scale = get_scale(env, argv[2]);
+        if (a_scale < 0) {
+                return nullptr;
+        }
+        const int b_scale = get_scale(env, argv[4]);
+        if (b_scale < 0) {
+                return nullptr;
+        }
+        if (n != a_n || n != b_n) {
+                napi_throw_range_error(env, nullptr, "Comp4 column lengths differ");
+                return nullptr;
+        }
+
+        // only the operand with the smaller scale is scaled up
+        if (a_scale >= b_scale) {
+                const int64_t m = pow10_table[a_scale - b_scale];
+                for (size_t i = 0; i < n; ++i) {
+                        dst[i] = compare_scaled(a[i], b[i], m);
+                }
+        } else {
+                const int64_t m = pow10_table[b_scale - a_scale];
+                for (size_t i = 0; i < n; ++i) {
+                        dst[i] = (int8_t)-compare_scaled(b[i], a[i], m);
+                }
+        }
+
+        return nullptr;
+}
+
+static napi_value Sum(napi_env env, napi_callback_info info)
+{
+        napi_status status;
+
+        size_t argc = 1;
+        napi_value argv[1];
+        status = napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+        assert(status == napi_ok && argc == 1);
+
+        int64_t *a;
+        size_t n;
+        if (!get_column(env, argv[0], &a, &n)) {
+                return nullptr;
+        }
+
+        // a running total may leave the range and come back, the sum is
+        // exact as long as the wraps cancel out
+        int64_t sum = 0;
+        int64_t wraps = 0;
+#ifdef CAM_COMP4_AVX2
+        if (!has_avx2() || !sum_avx2(a, n, &sum))
+#endif
+        {
+                sum = 0;
+                for (size_t i = 0; i < n; ++i) {
+                        if (add_overflow(sum, a[i], &sum)) {
+                                wraps += a[i] > 0 ? 1 : -1;
+                        }
+                }
+        }
+        if (wraps != 0) {
+                napi_throw_range_error(env, nullptr, "Comp4 sum out of range");
+                return nullptr;
+        }
+
+        napi_value ret;
+        status = napi_create_bigint_int64(env, sum, &ret);
+        assert(status == napi_ok);
+        return ret;
+}
+
+static napi_value min_max(napi_env env, napi_callback_info info, bool is_max)
+{
+        napi_status status;
+
+        size_t argc = 1;
+        napi_value argv[1];
+        status = napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+        assert(status == napi_ok && argc == 1);
+
+        int64_t *a;
+        size_t n;
+        if (!get_column(env, argv[0], &a, &n)) {
+                return nullptr;
+        }
+
+        napi_value ret;
+        if (n == 0) {
+                status = napi_get_undefined(env, &ret);
+                assert(status == napi_ok);
+                return ret;
+        }
+
+        int64_t m;
+#ifdef CAM_COMP4_AVX2
+        if (has_avx2()) {
+                m = min_max_avx2(a, n, is_max);
+        } else
+#endif
+        {
+                m = a[0];
+                for (size_t i = 1; i < n; ++i) {
+                        m = is_max ? max(m, a[i]) : min(m, a[i]);
+                }
+        }
+
+        status = napi_create_bigint_int64(env, m, &ret);
+        assert(status == napi_ok);
+        return ret;
+}
+
+static napi_value Min(napi_env env, napi_callback_info info)
+{
+        return min_max(env, info, false);
+}
+
+static napi_value Max(napi_env env, napi_callback_info info)
+{
+        return min_max(env, info, true);
+}
+
+// False with a pending RangeError unless `length` is within 1 and 10 and
+// `n` values of it fit in `packed_len` bytes.
+static bool check_packed_length(napi_env env, int32_t length, size_t n, size_t packed_len)
+{
+        if (length < 1 || length > 10) {
+                napi_throw_range_error(env, nullptr, "packed decimal length must be within 1 and 10");
+                return false;
+        }
+        if (n > packed_len / length) {
+                napi_throw_range_error(env, nullptr, "packed decimals overrun the buffer");
+                return false;
+        }
+        return true;
+}
+
+// Unpacks a buffer of fixed-length packed decimals into a column, returns
+// the index of the first bad value or -1.
+static napi_value Comp3Unpack(napi_env env, napi_callback_info info)
+{
+        napi_status status;
+
+        size_t argc = 3;
+        napi_value argv[3];
+        status = napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+        assert(status == napi_ok && argc == 3);
+
+        int64_t *dst;
+        size_t n;
+        if (!get_column(env, argv[0], &dst, &n)) {
+                return nullptr;
+        }
+
+        uint8_t *packed;
+        size_t packed_len;
+        status = napi_get_buffer_info(env, argv[1], (void**)&packed, &packed_len);
+        assert(status == napi_ok);
+
+        int32_t length;
+        status = napi_get_value_int32(env, argv[2], &length);
+        assert(status == napi_ok);
+        if (!check_packed_length(env, length, n, packed_len)) {
+                return nullptr;
+        }
+
+        int32_t bad = -1;
+        for (size_t i = 0; i < n; ++i) {
+                bool is_signed;
+                if (!comp3_unpack(packed + i * length, length, &is_signed, dst + i)) {
+                        bad = (int32_t)i;
+                        break;
+                }
+        }
+
+        napi_value ret;
+        status = napi_create_int32(env, bad, &ret);
+        assert(status == napi_ok);
+        return ret;
+}
+
+static napi_value Comp3Pack(napi_env env, napi_callback_info info)
+{
+        napi_status status;
+
+        size_t argc = 4;
+        napi_value argv[4];
+        status = napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+        assert(status == napi_ok && argc == 4);
+
+        uint8_t *packed;
+        size_t packed_len;
+        status = napi_get_buffer_info(env, argv[0], (void**)&packed, &packed_len);
+        assert(status == napi_ok);
+
+        int32_t length;
+        status = napi_get_value_int32(env, argv[1], &length);
+        assert(status == napi_ok);
+
+        int64_t *src;
+        size_t n;
+        if (!get_column(env, argv[2], &src, &n)) {
+                return nullptr;
+        }
+        if (!check_packed_length(env, length, n, packed_len)) {
+                return nullptr;
+        }
+
+        bool is_signed;
+        status = napi_get_value_bool(env, argv[3], &is_signed);
+        assert(status == napi_ok);
+
+        for (size_t i = 0; i < n; ++i) {
+                if (!comp3_pack(packed + i * length, length, is_signed, src[i])) {
+                        throw_out_of_range(env, i);
+                        return nullptr;
+                }
+        }
+
+        return nullptr;
+}
+
+void Comp4Init(napi_env env, napi_value exports)
+{
+        napi_status status;
+
+        const napi_property_descriptor props[] = {
+                DECLARE_NAPI_METHOD("comp4Rescale", &Rescale),
+                DECLARE_NAPI_METHOD("comp4Add",     &Add),
+                DECLARE_NAPI_METHOD("comp4Sub",     &Sub),
+                DECLARE_NAPI_METHOD("comp4Mul",     &Mul),
+                DECLARE_NAPI_METHOD("comp4Compare", &Compare),
+                DECLARE_NAPI_METHOD("comp4Sum",     &Sum),
+                DECLARE_NAPI_METHOD("comp4Min",     &Min),
+                DECLARE_NAPI_METHOD("comp4Max",     &Max),
+                DECLARE_NAPI_METHOD("comp3Unpack",  &Comp3Unpack),
+                DECLARE_NAPI_METHOD("comp3Pack",    &Comp3Pack)
+        };
+
+        const size_t num_props = sizeof(props) / sizeof(props[0]);
+
+        status = napi_define_properties(env, exports, num_props, props);
+        assert(status == napi_ok);
+}
+
+} } // namespace cam::native
@@ -1,3 +1,7 @@
-export { Cam, Foreign, SlotType, Comp4 } from './cam'
+export { Cam, CamOptions, Tracer, TraceOptions, Foreign, ChunkLoad, ChunksLoadResult, Using, InvokeResult, PackedInvokeResult, packValues, unpackValues, RunRecordsResult, ResultCacheStats, SlotType, Comp4 } from './cam'
 export { Assembler, Opcode } from './assembler'
+export { Comp4Column } from './comp4'
+export { Bundle, BundleWriter, BundleStats, ChunkManifest, ProgramRef, manifestPath, readManifest } from './bundle'
+export { RecordCodec, RecordLayout, Field, FieldType } from './record'
+export { RecordTransform, RecordTransformOptions } from './stream'
 export { ErrorCode } from './error'
@@ -0,0 +1,1092 @@
+#include "native_common.h"
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace cam { namespace native {
+
+// COBOL file status codes
+enum file_status
+{
+        FS_SUCCESS        = 0,
+        FS_END_OF_FILE    = 10,
+        FS_DUPLICATE_KEY  = 22,
+        FS_NOT_FOUND      = 23,
+        FS_IO_ERROR       = 30,
+        FS_BAD_ATTRIBUTES = 39,
+        FS_NOT_OPEN       = 42,
+        FS_LOCKED         = 93
+};
+
+static const uint32_t ISAM_PAGE_SIZE = 4096;
+static const uint32_t ISAM_MAGIC     = 0x4D415349;
+static const uint32_t ISAM_VERSION   = 1;
+static const uint32_t ISAM_MAX_ALTERNATE_KEYS = 16;
+
+enum page_type
+{
+        PAGE_LEAF = 1,
+        PAGE_INTERNAL
+};
+
+struct alternate_key
+{
+        uint32_t offset;
+        uint32_t length;
+        uint32_t duplicates;
+};
+
+// page 0
+struct file_header
+{
+        uint32_t magic;
+        uint32_t version;
+        uint32_t record_length;
+        uint32_t key_offset;
+        uint32_t key_length;
+        uint32_t root;
+        uint32_t num_pages;
+        uint32_t num_alternates;
+        alternate_key alternates[ISAM_MAX_ALTERNATE_KEYS];
+        uint32_t alternate_roots[ISAM_MAX_ALTERNATE_KEYS];
+};
+
+// Leaf pages hold whole records sorted by key, internal pages hold
+// `count + 1` child page numbers followed by `count` separator keys, the
+// separator `i` being the smallest key of child `i + 1`.
+struct page_header
+{
+        uint16_t type;
+        uint16_t count;
+        uint32_t next; // next leaf
+};
+
+// One B+tree of the file, tree 0 is keyed by the primary key and holds the
+// records. Tree `i` holds an entry per record made of alternate key `i`
+// followed by the primary key, the whole entry being its key so that
+// duplicate alternate keys still make unique entries.
+struct btree
+{
+        int index;
+        uint32_t record_length;
+        uint32_t key_offset;
+        uint32_t key_length;
+        uint32_t leaf_capacity;
+        uint32_t internal_capacity;
+};
+
+// B+trees over fixed-length records in a mmapped file. Writes go to shadow
+// copies of the touched pages; commit saves the original pages to an undo
+// journal, syncs it, applies the shadows and syncs them before the journal
+// is dropped. A commit that fails after the journal is synced leaves the
+// operation `pending`, it's rolled back from the journal before the file
+// is used again. Opening a file with a non-empty journal rolls the
+// interrupted operation back.
+struct indexed_file
+{
+        // held for the whole of an operation, including its syncs
+        mutex lock;
+        int fd;
+        uint8_t *mapped;
+        size_t map_size;
+        string journal_path;
+        vector<btree> trees;
+        // alternates[i] is the key of trees[i + 1]
+        vector<alternate_key> alternates;
+        map<uint32_t, vector<uint8_t>> dirty;
+        bool pending;
+        // sequential access resumes from `cursor`, a key of
+        // trees[cursor_tree], see `read_next`
+        int cursor_tree;
+        bool cursor_set;
+        bool cursor_inclusive;
+        vector<uint8_t> cursor;
+        // a record shorter than the file's padded with spaces
+        vector<uint8_t> padded;
+};
+
+static const uint8_t* page(indexed_file &f, uint32_t pno)
+{
+        auto itr = f.dirty.find(pno);
+        if (itr != f.dirty.end()) {
+                return itr->second.data();
+        }
+        assert((size_t)(pno + 1) * ISAM_PAGE_SIZE <= f.map_size);
+        return f.mapped + (size_t)pno * ISAM_PAGE_SIZE;
+}
+
+static uint8_t* writable_page(indexed_file &f, uint32_t pno)
+{
+        auto itr = f.dirty.find(pno);
+        if (itr != f.dirty.end()) {
+                return itr->second.data();
+        }
+
+        vector<uint8_t> &shadow = f.dirty[pno];
+        shadow.resize(ISAM_PAGE_SIZE);
+        if ((size_t)(pno + 1) * ISAM_PAGE_SIZE <= f.map_size) {
+                memcpy(shadow.data(), f.mapped + (size_t)pno * ISAM_PAGE_SIZE, ISAM_PAGE_SIZE);
+        }
+        return shadow.data();
+}
+
+static const file_header* header(indexed_file &f)
+{
+        return (const file_header*)page(f, 0);
+}
+
+static uint32_t root(indexed_file &f, const btree &t)
+{
+        const file_header *h = header(f);
+        return t.index == 0 ? h->root : h->alternate_roots[t.index - 1];
+}
+
+static void set_root(indexed_file &f, const btree &t, uint32_t pno)
+{
+        file_header *h = (file_header*)writable_page(f, 0);
+        if (t.index == 0) {
+                h->root = pno;
+        } else {
+                h->alternate_roots[t.index - 1] = pno;
+        }
+}
+
+static uint32_t alloc_page(indexed_file &f, page_type type)
+{
+        file_header *h = (file_header*)writable_page(f, 0);
+        const uint32_t pno = h->num_pages++;
+
+        page_header *p = (page_header*)writable_page(f, pno);
+        p->type  = (uint16_t)type;
+        p->count = 0;
+        p->next  = 0;
+        return pno;
+}
+
+static uint8_t* leaf_record(const uint8_t *p, const btree &t, int i)
+{
+        return (uint8_t*)p + sizeof(page_header) + (size_t)i * t.record_length;
+}
+
+static uint32_t* internal_children(const uint8_t *p)
+{
+        return (uint32_t*)(p + sizeof(page_header));
+}
+
+static uint8_t* internal_key(const uint8_t *p, const btree &t, int i)
+{
+        return (uint8_t*)p + sizeof(page_header) + (t.internal_capacity + 1) * sizeof(uint32_t) + (size_t)i * t.key_length;
+}
+
+static int compare_key(const btree &t, const uint8_t *a, const uint8_t *b)
+{
+        return memcmp(a, b, t.key_length);
+}
+
+static bool init_tree(btree &t, int index, uint32_t record_length, uint32_t key_offset, uint32_t key_length)
+{
+        t.index = index;
+        t.record_length = record_length;
+        t.key_offset = key_offset;
+        t.key_length = key_length;
+        t.leaf_capacity = (ISAM_PAGE_SIZE - sizeof(page_header)) / record_length;
+        t.internal_capacity = (ISAM_PAGE_SIZE - sizeof(page_header) - sizeof(uint32_t)) / (key_length + sizeof(uint32_t));
+        return key_length > 0 && key_offset + key_length <= record_length
+            && t.leaf_capacity >= 2 && t.internal_capacity >= 3;
+}
+
+// Maps the first `size` bytes of the file, the old mapping stays if that
+// fails.
+static bool remap(indexed_file &f, size_t size)
+{
+        void *m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, f.fd, 0);
+        if (m == MAP_FAILED) {
+                return false;
+        }
+
+        if (f.mapped) {
+                munmap(f.mapped, f.map_size);
+        }
+        f.mapped = (uint8_t*)m;
+        f.map_size = size;
+        return true;
+}
+
+static bool write_fully(int fd, const void *buf, size_t n)
+{
+        const uint8_t *p = (const uint8_t*)buf;
+        while (n > 0) {
+                const ssize_t w = write(fd, p, n);
+                if (w <= 0) {
+                        return false;
+                }
+                p += w;
+                n -= (size_t)w;
+        }
+        return true;
+}
+
+// msyncs the dirty pages only, a run of adjacent ones at a time. msync
+// wants system page aligned addresses, which may be coarser than
+// ISAM_PAGE_SIZE.
+static bool sync_dirty_pages(indexed_file &f)
+{
+        const size_t system_page = (size_t)sysconf(_SC_PAGESIZE);
+
+        auto itr = f.dirty.begin();
+        while (itr != f.dirty.end()) {
+                const uint32_t first = itr->first;
+                uint32_t last = first;
+                for (++itr; itr != f.dirty.end() && itr->first == last + 1; ++itr) {
+                        last = itr->first;
+                }
+
+                size_t b = (size_t)first * ISAM_PAGE_SIZE;
+                const size_t e = (size_t)(last + 1) * ISAM_PAGE_SIZE;
+                b -= b % system_page;
+                if (msync(f.mapped + b, e - b, MS_SYNC) != 0) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+static bool commit(indexed_file &f)
+{
+        if (f.dirty.empty()) {
+                return true;
+        }
+        // truncating the journal of a pending operation would lose what
+        // rolls it back
+        assert(!f.pending);
+
+        const int jfd = open(f.journal_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (jfd < 0) {
+                f.dirty.clear();
+                return false;
+        }
+
+        bool ok = true;
+        for (auto itr = f.dirty.begin(); itr != f.dirty.end() && ok; ++itr) {
+                if ((size_t)(itr->first + 1) * ISAM_PAGE_SIZE <= f.map_size) {
+                        ok = write_fully(jfd, &itr->first, sizeof(itr->first))
+                          && write_fully(jfd, f.mapped + (size_t)itr->first * ISAM_PAGE_SIZE, ISAM_PAGE_SIZE);
+                }
+        }
+        ok = ok && fsync(jfd) == 0;
+
+        // the file is untouched, the operation is just dropped
+        if (!ok) {
+                close(jfd);
+                f.dirty.clear();
+                return false;
+        }
+
+        f.pending = true;
+
+        const size_t size = (size_t)header(f)->num_pages * ISAM_PAGE_SIZE;
+        if (size > f.map_size) {
+                ok = ftruncate(f.fd, (off_t)size) == 0 && remap(f, size);
+        }
+
+        if (ok) {
+                for (auto itr = f.dirty.begin(); itr != f.dirty.end(); ++itr) {
+                        memcpy(f.mapped + (size_t)itr->first * ISAM_PAGE_SIZE, itr->second.data(), ISAM_PAGE_SIZE);
+                }
+                ok = sync_dirty_pages(f);
+        }
+
+        // the journal is only dropped once the file is durable
+        ok = ok && ftruncate(jfd, 0) == 0 && fsync(jfd) == 0;
+        close(jfd);
+
+        if (ok) {
+                f.dirty.clear();
+                f.pending = false;
+        }
+        return ok;
+}
+
+static bool recover(int fd, const string &journal_path)
+{
+        const int jfd = open(journal_path.c_str(), O_RDWR);
+        if (jfd < 0) {
+                return true;
+        }
+
+        // a torn entry means the crash hit before the file was touched
+        bool ok = true;
+        uint32_t pno;
+        vector<uint8_t> buf(ISAM_PAGE_SIZE);
+        while (ok && read(jfd, &pno, sizeof(pno)) == sizeof(pno)
+                  && read(jfd, buf.data(), ISAM_PAGE_SIZE) == ISAM_PAGE_SIZE) {
+                ok = pwrite(fd, buf.data(), ISAM_PAGE_SIZE, (off_t)pno * ISAM_PAGE_SIZE) == ISAM_PAGE_SIZE;
+        }
+
+        ok = ok && fsync(fd) == 0 && ftruncate(jfd, 0) == 0 && fsync(jfd) == 0;
+        close(jfd);
+        return ok;
+}
+
+// Restores the pages of a pending operation from its journal, the mapping
+// is shared so it sees the writes. It stays pending if that fails.
+static bool roll_back(indexed_file &f)
+{
+        if (!f.pending) {
+                return true;
+        }
+        if (!recover(f.fd, f.journal_path)) {
+                return false;
+        }
+        f.dirty.clear();
+        f.pending = false;
+        return true;
+}
+
+// A pending operation is left to the journal for the next open if it can't
+// be rolled back now.
+static void close_file(indexed_file &f)
+{
+        if (f.fd >= 0) {
+                roll_back(f);
+        }
+        if (f.mapped) {
+                munmap(f.mapped, f.map_size);
+                f.mapped = nullptr;
+        }
+        if (f.fd >= 0) {
+                close(f.fd);
+                f.fd = -1;
+        }
+}
+
+// Parses the alternate keys of ISAM-OPEN, e.g. "21,10,D,41,8,U", that is
+// 1-based position, length and D if duplicates are allowed or U if not.
+static bool parse_alternates(const string &keys, vector<alternate_key> &alternates)
+{
+        vector<string> parts;
+        size_t b = 0;
+        for (;;) {
+                const size_t e = keys.find(',', b);
+                string part = keys.substr(b, e == string::npos ? string::npos : e - b);
+                part.erase(0, min(part.find_first_not_of(' '), part.size()));
+                part.erase(part.find_last_not_of(' ') + 1);
+                parts.push_back(part);
+                if (e == string::npos) {
+                        break;
+                }
+                b = e + 1;
+        }
+        if (parts.size() == 1 && parts[0].empty()) {
+                return true;
+        }
+        if (parts.size() % 3 != 0 || parts.size() / 3 > ISAM_MAX_ALTERNATE_KEYS) {
+                return false;
+        }
+
+        for (size_t i = 0; i < parts.size(); i += 3) {
+                const int position = atoi(parts[i].c_str());
+                const int length   = atoi(parts[i + 1].c_str());
+                if (position <= 0 || length <= 0 || (parts[i + 2] != "D" && parts[i + 2] != "U")) {
+                        return false;
+                }
+                alternate_key k;
+                k.offset     = (uint32_t)position - 1;
+                k.length     = (uint32_t)length;
+                k.duplicates = parts[i + 2] == "D";
+                alternates.push_back(k);
+        }
+        return true;
+}
+
+static int open_file(
+        indexed_file &f, const string &path, uint32_t record_length, uint32_t key_offset, uint32_t key_length,
+        const vector<alternate_key> &alternates)
+{
+        f.fd = -1;
+        f.mapped = nullptr;
+        f.map_size = 0;
+        f.journal_path = path + ".jnl";
+        f.alternates = alternates;
+        f.pending = false;
+        f.cursor_tree = 0;
+        f.cursor_set = false;
+        f.cursor_inclusive = true;
+
+        f.trees.resize(alternates.size() + 1);
+        if (!init_tree(f.trees[0], 0, record_length, key_offset, key_length)) {
+                return FS_BAD_ATTRIBUTES;
+        }
+        for (size_t i = 0; i < alternates.size(); ++i) {
+                const uint32_t entry_length = alternates[i].length + key_length;
+                if (alternates[i].offset + alternates[i].length > record_length
+                 || !init_tree(f.trees[i + 1], (int)i + 1, entry_length, 0, entry_length)) {
+                        return FS_BAD_ATTRIBUTES;
+                }
+        }
+
+        f.fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (f.fd < 0) {
+                return FS_IO_ERROR;
+        }
+
+        // one writer per file, across processes and within this one, as
+        // flock locks belong to the open file description; this also
+        // guards the journal
+        if (flock(f.fd, LOCK_EX | LOCK_NB) != 0) {
+                return errno == EWOULDBLOCK ? FS_LOCKED : FS_IO_ERROR;
+        }
+
+        if (!recover(f.fd, f.journal_path)) {
+                return FS_IO_ERROR;
+        }
+
+        struct stat st;
+        if (fstat(f.fd, &st) != 0) {
+                return FS_IO_ERROR;
+        }
+
+        if (st.st_size == 0) {
+                file_header *h = (file_header*)writable_page(f, 0);
+                h->magic          = ISAM_MAGIC;
+                h->version        = ISAM_VERSION;
+                h->record_length  = record_length;
+                h->key_offset     = key_offset;
+                h->key_length     = key_length;
+                h->num_pages      = 1;
+                h->num_alternates = (uint32_t)alternates.size();
+                for (size_t i = 0; i < alternates.size(); ++i) {
+                        h->alternates[i] = alternates[i];
+                }
+                for (size_t i = 0; i < f.trees.size(); ++i) {
+                        set_root(f, f.trees[i], alloc_page(f, PAGE_LEAF));
+                }
+                return commit(f) ? FS_SUCCESS : FS_IO_ERROR;
+        }
+
+        if (st.st_size < (off_t)ISAM_PAGE_SIZE || !remap(f, (size_t)st.st_size)) {
+                return FS_IO_ERROR;
+        }
+
+        const file_header *h = header(f);
+        if (h->magic != ISAM_MAGIC || h->version != ISAM_VERSION
+         || h->record_length != record_length || h->key_offset != key_offset || h->key_length != key_length
+         || h->num_alternates != alternates.size()
+         || (size_t)h->num_pages * ISAM_PAGE_SIZE > f.map_size) {
+                return FS_BAD_ATTRIBUTES;
+        }
+        for (size_t i = 0; i < alternates.size(); ++i) {
+                if (h->alternates[i].offset != alternates[i].offset
+                 || h->alternates[i].length != alternates[i].length
+                 || h->alternates[i].duplicates != alternates[i].duplicates) {
+                        return FS_BAD_ATTRIBUTES;
+                }
+        }
+
+        return FS_SUCCESS;
+}
+
+// index of the child of internal page `p` that may hold `key`
+static int child_index(const btree &t, const uint8_t *p, const uint8_t *key)
+{
+        const int count = ((const page_header*)p)->count;
+        int lo = 0, hi = count;
+        while (lo < hi) {
+                const int mid = (lo + hi) / 2;
+                if (compare_key(t, key, internal_key(p, t, mid)) < 0) {
+                        hi = mid;
+                } else {
+                        lo = mid + 1;
+                }
+        }
+        return lo;
+}
+
+// first record of leaf `p` whose key is >= `key` (> if not `inclusive`)
+static int leaf_bound(const btree &t, const uint8_t *p, const uint8_t *key, bool inclusive)
+{
+        const int count = ((const page_header*)p)->count;
+        int lo = 0, hi = count;
+        while (lo < hi) {
+                const int mid = (lo + hi) / 2;
+                const int r = compare_key(t, leaf_record(p, t, mid) + t.key_offset, key);
+                if (r < 0 || (r == 0 && !inclusive)) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        return lo;
+}
+
+// Descends to the leaf for `key`, the leftmost leaf if `key` is null,
+// recording the internal pages and child indices on the way down.
+static uint32_t find_leaf(indexed_file &f, const btree &t, const uint8_t *key, vector<pair<uint32_t, int>> *path)
+{
+        uint32_t pno = root(f, t);
+        for (;;) {
+                const uint8_t *p = page(f, pno);
+                if (((const page_header*)p)->type == PAGE_LEAF) {
+                        return pno;
+                }
+                const int i = key ? child_index(t, p, key) : 0;
+                if (path) {
+                        path->push_back(make_pair(pno, i));
+                }
+                pno = internal_children(p)[i];
+        }
+}
+
+// Inserts `key` and its right sibling `right` into the parents on `path`,
+// splitting them as needed and growing a new root at the top.
+static void insert_separator(
+        indexed_file &f, const btree &t, vector<pair<uint32_t, int>> &path, vector<uint8_t> key, uint32_t right)
+{
+        const uint32_t kl = t.key_length;
+
+        while (!path.empty()) {
+                const uint32_t pno = path.back().first;
+                const int at = path.back().second;
+                path.pop_back();
+
+                uint8_t *p = writable_page(f, pno);
+                page_header *ph = (page_header*)p;
+                const int count = ph->count;
+
+                vector<uint8_t> keys((size_t)(count + 1) * kl);
+                vector<uint32_t> children(count + 2);
+                memcpy(keys.data(), internal_key(p, t, 0), (size_t)at * kl);
+                memcpy(&keys[(size_t)at * kl], key.data(), kl);
+                memcpy(&keys[(size_t)(at + 1) * kl], internal_key(p, t, at), (size_t)(count - at) * kl);
+                memcpy(children.data(), internal_children(p), (at + 1) * sizeof(uint32_t));
+                children[at + 1] = right;
+                memcpy(&children[at + 2], internal_children(p) + at + 1, (count - at) * sizeof(uint32_t));
+
+                if ((uint32_t)count + 1 <= t.internal_capacity) {
+                        ph->count = (uint16_t)(count + 1);
+                        memcpy(internal_key(p, t, 0), keys.data(), keys.size());
+                        memcpy(internal_children(p), children.data(), children.size() * sizeof(uint32_t));
+                        return;
+                }
+
+                // the middle key moves up
+                const int n = count + 1, m = n / 2;
+                const uint32_t rno = alloc_page(f, PAGE_INTERNAL);
+                p = writable_page(f, pno);
+                uint8_t *r = writable_page(f, rno);
+
+                ((page_header*)p)->count = (uint16_t)m;
+                memcpy(internal_key(p, t, 0), keys.data(), (size_t)m * kl);
+                memcpy(internal_children(p), children.data(), (m + 1) * sizeof(uint32_t));
+
+                ((page_header*)r)->count = (uint16_t)(n - m - 1);
+                memcpy(internal_key(r, t, 0), &keys[(size_t)(m + 1) * kl], (size_t)(n - m - 1) * kl);
+                memcpy(internal_children(r), &children[m + 1], (n - m) * sizeof(uint32_t));
+
+                key.assign(&keys[(size_t)m * kl], &keys[(size_t)(m + 1) * kl]);
+                right = rno;
+        }
+
+        const uint32_t old_root = root(f, t);
+        const uint32_t new_root = alloc_page(f, PAGE_INTERNAL);
+        uint8_t *p = writable_page(f, new_root);
+        ((page_header*)p)->count = 1;
+        internal_children(p)[0] = old_root;
+        internal_children(p)[1] = right;
+        memcpy(internal_key(p, t, 0), key.data(), t.key_length);
+        set_root(f, t, new_root);
+}
+
+// Adds `record` to the shadow pages of `t`, the caller has checked that
+// its key isn't there yet.
+static void tree_insert(indexed_file &f, const btree &t, const uint8_t *record)
+{
+        const uint8_t *key = record + t.key_offset;
+        const uint32_t rl = t.record_length;
+
+        vector<pair<uint32_t, int>> path;
+        const uint32_t lno = find_leaf(f, t, key, &path);
+        const int count = ((const page_header*)page(f, lno))->count;
+        const int at = leaf_bound(t, page(f, lno), key, true);
+
+        uint8_t *p = writable_page(f, lno);
+        if ((uint32_t)count < t.leaf_capacity) {
+                memmove(leaf_record(p, t, at + 1), leaf_record(p, t, at), (size_t)(count - at) * rl);
+                memcpy(leaf_record(p, t, at), record, rl);
+                ((page_header*)p)->count = (uint16_t)(count + 1);
+                return;
+        }
+
+        vector<uint8_t> records((size_t)(count + 1) * rl);
+        memcpy(records.data(), leaf_record(p, t, 0), (size_t)at * rl);
+        memcpy(&records[(size_t)at * rl], record, rl);
+        memcpy(&records[(size_t)(at + 1) * rl], leaf_record(p, t, at), (size_t)(count - at) * rl);
+
+        const int n = count + 1, m = n / 2;
+        const uint32_t rno = alloc_page(f, PAGE_LEAF);
+        p = writable_page(f, lno);
+        uint8_t *r = writable_page(f, rno);
+
+        ((page_header*)r)->count = (uint16_t)(n - m);
+        ((page_header*)r)->next  = ((page_header*)p)->next;
+        memcpy(leaf_record(r, t, 0), &records[(size_t)m * rl], (size_t)(n - m) * rl);
+
+        ((page_header*)p)->count = (uint16_t)m;
+        ((page_header*)p)->next  = rno;
+        memcpy(leaf_record(p, t, 0), records.data(), (size_t)m * rl);
+
+        const uint8_t *sep = &records[(size_t)m * rl + t.key_offset];
+        insert_separator(f, t, path, vector<uint8_t>(sep, sep + t.key_length), rno);
+}
+
+// locates the record of `t` with `key`, -1 if there is none
+static int tree_find(indexed_file &f, const btree &t, const uint8_t *key, uint32_t *lno)
+{
+        *lno = find_leaf(f, t, key, nullptr);
+        const uint8_t *leaf = page(f, *lno);
+        const int at = leaf_bound(t, leaf, key, true);
+        if (at < ((const page_header*)leaf)->count
+         && compare_key(t, leaf_record(leaf, t, at) + t.key_offset, key) == 0) {
+                return at;
+        }
+        return -1;
+}
+
+// leaves aren't merged, an emptied leaf stays in the chain
+static void tree_remove(indexed_file &f, const btree &t, const uint8_t *key)
+{
+        uint32_t lno;
+        const int at = tree_find(f, t, key, &lno);
+        assert(at >= 0);
+
+        uint8_t *p = writable_page(f, lno);
+        const int count = ((page_header*)p)->count;
+        memmove(leaf_record(p, t, at), leaf_record(p, t, at + 1), (size_t)(count - at - 1) * t.record_length);
+        ((page_header*)p)->count = (uint16_t)(count - 1);
+}
+
+// First record of `t` whose key is >= `key` (> if not `inclusive`), the
+// first one of all if `key` is null, or null at the end.
+static const uint8_t* tree_next(indexed_file &f, const btree &t, const uint8_t *key, bool inclusive)
+{
+        uint32_t lno = find_leaf(f, t, key, nullptr);
+        const uint8_t *leaf = page(f, lno);
+        int at = key ? leaf_bound(t, leaf, key, inclusive) : 0;
+
+        while (at >= ((const page_header*)leaf)->count) {
+                lno = ((const page_header*)leaf)->next;
+                if (lno == 0) {
+                        return nullptr;
+                }
+                leaf = page(f, lno);
+                at = 0;
+        }
+        return leaf_record(leaf, t, at);
+}
+
+// entry of alternate key `i` for `record`
+static vector<uint8_t> alternate_entry(const indexed_file &f, int i, const uint8_t *record)
+{
+        const alternate_key &k = f.alternates[i];
+        const btree &primary = f.trees[0];
+        vector<uint8_t> entry(record + k.offset, record + k.offset + k.length);
+        entry.insert(entry.end(), record + primary.key_offset, record + primary.key_offset + primary.key_length);
+        return entry;
+}
+
+// The smallest entry of alternate key `i` that may have the key value of
+// `record`, the primary key part being zeros.
+static vector<uint8_t> alternate_lower_bound(const indexed_file &f, int i, const uint8_t *record)
+{
+        const alternate_key &k = f.alternates[i];
+        vector<uint8_t> entry(record + k.offset, record + k.offset + k.length);
+        entry.resize(f.trees[i + 1].key_length, 0);
+        return entry;
+}
+
+// first entry of alternate key `i` with the key value of `record`, if any
+static const uint8_t* find_alternate(indexed_file &f, int i, const uint8_t *record)
+{
+        const vector<uint8_t> bound = alternate_lower_bound(f, i, record);
+        const uint8_t *entry = tree_next(f, f.trees[i + 1], bound.data(), true);
+        if (entry && memcmp(entry, record + f.alternates[i].offset, f.alternates[i].length) == 0) {
+                return entry;
+        }
+        return nullptr;
+}
+
+// the record of the alternate key entry `entry`
+static const uint8_t* alternate_record(indexed_file &f, int i, const uint8_t *entry)
+{
+        const btree &primary = f.trees[0];
+        uint32_t lno;
+        const int at = tree_find(f, primary, entry + f.alternates[i].length, &lno);
+        assert(at >= 0);
+        return leaf_record(page(f, lno), primary, at);
+}
+
+// True if `record` would duplicate a unique alternate key of another
+// record than `old`, if not null.
+static bool duplicates_alternate(indexed_file &f, const uint8_t *record, const uint8_t *old)
+{
+        for (size_t i = 0; i < f.alternates.size(); ++i) {
+                const alternate_key &k = f.alternates[i];
+                if (k.duplicates || (old && memcmp(record + k.offset, old + k.offset, k.length) == 0)) {
+                        continue;
+                }
+                if (find_alternate(f, (int)i, record)) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+static void set_cursor(indexed_file &f, int tree, const uint8_t *key, bool inclusive)
+{
+        f.cursor.assign(key, key + f.trees[tree].key_length);
+        f.cursor_tree = tree;
+        f.cursor_set = true;
+        f.cursor_inclusive = inclusive;
+}
+
+static int write_record(indexed_file &f, const uint8_t *record, int, const uint8_t**)
+{
+        const btree &primary = f.trees[0];
+        uint32_t lno;
+        if (tree_find(f, primary, record + primary.key_offset, &lno) >= 0
+         || duplicates_alternate(f, record, nullptr)) {
+                return FS_DUPLICATE_KEY;
+        }
+
+        tree_insert(f, primary, record);
+        for (size_t i = 0; i < f.alternates.size(); ++i) {
+                tree_insert(f, f.trees[i + 1], alternate_entry(f, (int)i, record).data());
+        }
+        return commit(f) ? FS_SUCCESS : FS_IO_ERROR;
+}
+
+// by the primary key for key 0, else by alternate key `key` - 1, the first
+// record with that value if it has duplicates, `found` pointing at it until
+// the next write
+static int read_record(indexed_file &f, const uint8_t *record, int key, const uint8_t **found)
+{
+        if (key == 0) {
+                const btree &primary = f.trees[0];
+                uint32_t lno;
+                const int at = tree_find(f, primary, record + primary.key_offset, &lno);
+                if (at < 0) {
+                        return FS_NOT_FOUND;
+                }
+                *found = leaf_record(page(f, lno), primary, at);
+                set_cursor(f, 0, *found + primary.key_offset, false);
+        } else {
+                const uint8_t *entry = find_alternate(f, key - 1, record);
+                if (!entry) {
+                        return FS_NOT_FOUND;
+                }
+                *found = alternate_record(f, key - 1, entry);
+                set_cursor(f, key, entry, false);
+        }
+        return FS_SUCCESS;
+}
+
+static int rewrite_record(indexed_file &f, const uint8_t *record, int, const uint8_t**)
+{
+        const btree &primary = f.trees[0];
+        uint32_t lno;
+        const int at = tree_find(f, primary, record + primary.key_offset, &lno);
+        if (at < 0) {
+                return FS_NOT_FOUND;
+        }
+
+        const uint8_t *p = leaf_record(page(f, lno), primary, at);
+        const vector<uint8_t> old(p, p + primary.record_length);
+        if (duplicates_alternate(f, record, old.data())) {
+                return FS_DUPLICATE_KEY;
+        }
+
+        for (size_t i = 0; i < f.alternates.size(); ++i) {
+                const vector<uint8_t> from = alternate_entry(f, (int)i, old.data());
+                const vector<uint8_t> to   = alternate_entry(f, (int)i, record);
+                if (from != to) {
+                        tree_remove(f, f.trees[i + 1], from.data());
+                        tree_insert(f, f.trees[i + 1], to.data());
+                }
+        }
+
+        memcpy(leaf_record(writable_page(f, lno), primary, at), record, primary.record_length);
+        return commit(f) ? FS_SUCCESS : FS_IO_ERROR;
+}
+
+static int delete_record(indexed_file &f, const uint8_t *record, int, const uint8_t**)
+{
+        const btree &primary = f.trees[0];
+        uint32_t lno;
+        const int at = tree_find(f, primary, record + primary.key_offset, &lno);
+        if (at < 0) {
+                return FS_NOT_FOUND;
+        }
+
+        const uint8_t *p = leaf_record(page(f, lno), primary, at);
+        const vector<uint8_t> old(p, p + primary.record_length);
+        for (size_t i = 0; i < f.alternates.size(); ++i) {
+                tree_remove(f, f.trees[i + 1], alternate_entry(f, (int)i, old.data()).data());
+        }
+        tree_remove(f, primary, old.data() + primary.key_offset);
+        return commit(f) ? FS_SUCCESS : FS_IO_ERROR;
+}
+
+// positions at the first record whose key `key` is >= that of `record`
+static int start(indexed_file &f, const uint8_t *record, int key, const uint8_t**)
+{
+        if (key == 0) {
+                set_cursor(f, 0, record + f.trees[0].key_offset, true);
+        } else {
+                set_cursor(f, key, alternate_lower_bound(f, key - 1, record).data(), true);
+        }
+        return FS_SUCCESS;
+}
+
+// The cursor is a key rather than a page position, so that it stays valid
+// across writes, each read re-descends from the root. Reads follow the key
+// of the last READ or START. `found` is as for `read_record`.
+static int read_next(indexed_file &f, const uint8_t*, int, const uint8_t **found)
+{
+        const btree &t = f.trees[f.cursor_tree];
+        const uint8_t *key = f.cursor_set ? f.cursor.data() : nullptr;
+        const uint8_t *next = tree_next(f, t, key, f.cursor_inclusive);
+        if (!next) {
+                return FS_END_OF_FILE;
+        }
+
+        *found = t.index == 0 ? next : alternate_record(f, t.index - 1, next);
+        set_cursor(f, t.index, next + t.key_offset, false);
+        return FS_SUCCESS;
+}
+
+// Handles are per instance, a closed file's handle is given to the next
+// open. The table is only locked to look a handle up, operations then hold
+// the file's own lock, so that one file's syncs don't hold up the others.
+struct indexed_files
+{
+        mutex m;
+        vector<shared_ptr<indexed_file>> files;
+};
+
+indexed_files* indexed_files_new()
+{
+        return new indexed_files();
+}
+
+// the files still open are closed, which releases their locks
+void indexed_files_drop(indexed_files *files)
+{
+        for (shared_ptr<indexed_file> &f : files->files) {
+                if (f) {
+                        lock_guard<mutex> lock(f->lock);
+                        close_file(*f);
+                }
+        }
+        delete files;
+}
+
+static shared_ptr<indexed_file> get_file(indexed_files *t, int64_t handle)
+{
+        lock_guard<mutex> lock(t->m);
+        if (handle < 1 || handle > (int64_t)t->files.size()) {
+                return nullptr;
+        }
+        return t->files[handle - 1];
+}
+
+// the handle of `f`, the lowest one free
+static int64_t add_file(indexed_files *t, const shared_ptr<indexed_file> &f)
+{
+        lock_guard<mutex> lock(t->m);
+        for (size_t i = 0; i < t->files.size(); ++i) {
+                if (!t->files[i]) {
+                        t->files[i] = f;
+                        return (int64_t)i + 1;
+                }
+        }
+        t->files.push_back(f);
+        return (int64_t)t->files.size();
+}
+
+static void set_status(struct cam_s *cam, int status)
+{
+        cam_set_slot_comp_4(cam, -1, false, 0, status);
+}
+
+static string get_slot_path(struct cam_s *cam, int slot)
+{
+        int length;
+        const char *str = cam_get_slot_display(cam, slot, &length);
+        string path(str, length);
+        path.erase(path.find_last_not_of(' ') + 1);
+        return path;
+}
+
+// CALL 'SYSTEM:ISAM-OPEN' USING path record-length key-position key-length
+//                               [alternate-keys] handle file-status
+// where `alternate-keys` is e.g. "21,10,D,41,8,U", see `parse_alternates`.
+// A file is open at most once at a time, another open gets status 93.
+static void isam_open(struct cam_s *cam, int num_usings, void *ud)
+{
+        if (num_usings != 6 && num_usings != 7) {
+                return;
+        }
+
+        const string path = get_slot_path(cam, -num_usings);
+        const int64_t record_length = get_slot_integer(cam, 1 - num_usings);
+        const int64_t key_position  = get_slot_integer(cam, 2 - num_usings);
+        const int64_t key_length    = get_slot_integer(cam, 3 - num_usings);
+
+        vector<alternate_key> alternates;
+        bool valid = record_length > 0 && key_position > 0 && key_length > 0;
+        if (valid && num_usings == 7) {
+                int length;
+                const char *str = cam_get_slot_display(cam, -3, &length);
+                valid = parse_alternates(string(str, length), alternates);
+        }
+
+        int status = FS_BAD_ATTRIBUTES;
+        if (valid) {
+                shared_ptr<indexed_file> f = make_shared<indexed_file>();
+                status = open_file(*f, path, (uint32_t)record_length, (uint32_t)key_position - 1, (uint32_t)key_length, alternates);
+                if (status == FS_SUCCESS) {
+                        cam_set_slot_comp_4(cam, -2, false, 0, (cam_comp_4_t)add_file((indexed_files*)ud, f));
+                } else {
+                        close_file(*f);
+                }
+        }
+
+        set_status(cam, status);
+}
+
+// CALL 'SYSTEM:ISAM-CLOSE' USING handle file-status
+static void isam_close(struct cam_s *cam, int num_usings, void *ud)
+{
+        if (num_usings != 2) {
+                return;
+        }
+
+        indexed_files *t = (indexed_files*)ud;
+        const int64_t handle = get_slot_integer(cam, -2);
+        shared_ptr<indexed_file> f;
+        {
+                lock_guard<mutex> lock(t->m);
+                if (handle >= 1 && handle <= (int64_t)t->files.size()) {
+                        f.swap(t->files[handle - 1]);
+                }
+        }
+        if (!f) {
+                set_status(cam, FS_NOT_OPEN);
+                return;
+        }
+
+        // waits for an operation that looked the handle up before
+        lock_guard<mutex> lock(f->lock);
+        close_file(*f);
+        set_status(cam, FS_SUCCESS);
+}
+
+// CALL 'SYSTEM:ISAM-<op>' USING handle record [key-number] file-status, the
+// key is taken from `record`, which receives the record read. `key-number`
+// picks the key of READ and START, 0 for the primary key (the default) and
+// `i` for the i-th alternate key.
+static void isam_record_op(
+        struct cam_s *cam, int num_usings, void *ud, int (*op)(indexed_file&, const uint8_t*, int, const uint8_t**))
+{
+        if (num_usings != 3 && num_usings != 4) {
+                return;
+        }
+
+        shared_ptr<indexed_file> f = get_file((indexed_files*)ud, get_slot_integer(cam, -num_usings));
+        if (!f) {
+                set_status(cam, FS_NOT_OPEN);
+                return;
+        }
+
+        lock_guard<mutex> lock(f->lock);
+        // closed while this waited
+        if (f->fd < 0) {
+                set_status(cam, FS_NOT_OPEN);
+                return;
+        }
+
+        const int64_t key = num_usings == 4 ? get_slot_integer(cam, -2) : 0;
+        if (key < 0 || key >= (int64_t)f->trees.size()) {
+                set_status(cam, FS_BAD_ATTRIBUTES);
+                return;
+        }
+
+        if (!roll_back(*f)) {
+                set_status(cam, FS_IO_ERROR);
+                return;
+        }
+
+        // the record is only copied to pad a short one
+        const uint32_t record_length = f->trees[0].record_length;
+        int length;
+        const uint8_t *record = (const uint8_t*)cam_get_slot_display(cam, 1 - num_usings, &length);
+        if ((uint32_t)length < record_length) {
+                f->padded.assign(record_length, ' ');
+                memcpy(f->padded.data(), record, length);
+                record = f->padded.data();
+        }
+
+        const uint8_t *found = nullptr;
+        const int status = op(*f, record, (int)key, &found);
+        if (status == FS_SUCCESS && found) {
+                memcpy(cam_set_slot_display(cam, 1 - num_usings, nullptr, record_length), found, record_length);
+        }
+        set_status(cam, status);
+}
+
+static void isam_read     (struct cam_s *cam, int n, void *ud) { isam_record_op(cam, n, ud, &read_record); }
+static void isam_read_next(struct cam_s *cam, int n, void *ud) { isam_record_op(cam, n, ud, &read_next); }
+static void isam_write    (struct cam_s *cam, int n, void *ud) { isam_record_op(cam, n, ud, &write_record); }
+static void isam_rewrite  (struct cam_s *cam, int n, void *ud) { isam_record_op(cam, n, ud, &rewrite_record); }
+static void isam_delete   (struct cam_s *cam, int n, void *ud) { isam_record_op(cam, n, ud, &delete_record); }
+static void isam_start    (struct cam_s *cam, int n, void *ud) { isam_record_op(cam, n, ud, &start); }
+
+static char open_name[]        = "ISAM-OPEN";
+static char close_name[]       = "ISAM-CLOSE";
+static char read_name[]        = "ISAM-READ";
+static char read_next_name[]   = "ISAM-READ-NEXT";
+static char write_name[]       = "ISAM-WRITE";
+static char rewrite_name[]     = "ISAM-REWRITE";
+static char delete_name[]      = "ISAM-DELETE";
+static char start_name[]       = "ISAM-START";
+
+void IndexedFilePrograms(vector<cam_foreign_program_t> &programs, indexed_files *files)
+{
+        add_program(programs, open_name,      &isam_open,      files);
+        add_program(programs, close_name,     &isam_close,     files);
+        add_program(programs, read_name,      &isam_read,      files);
+        add_program(programs, read_next_name, &isam_read_next, files);
+        add_program(programs, write_name,     &isam_write,     files);
+        add_program(programs, rewrite_name,   &isam_rewrite,   files);
+        add_program(programs, delete_name,    &isam_delete,    files);
+        add_program(programs, start_name,     &isam_start,     files);
+}
+
+} } // namespace cam::native
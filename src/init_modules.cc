@@ -4,11 +4,15 @@ namespace cam { namespace native {
 
 void CamInit      (napi_env env, napi_value exports);
 void AssemblerInit(napi_env env, napi_value exports);
+void Comp4Init    (napi_env env, napi_value exports);
+void RecordInit   (napi_env env, napi_value exports);
 
 static napi_value Init(napi_env env, napi_value exports)
 {
         CamInit      (env, exports);
         AssemblerInit(env, exports);
+        Comp4Init    (env, exports);
+        RecordInit   (env, exports);
         return exports;
 }
 
@@ -0,0 +1,35 @@
+#include "native_common.h"
+
+using namespace std;
+
+namespace cam { namespace native {
+
+static char system_module[] = "SYSTEM";
+
+int64_t get_slot_integer(struct cam_s *cam, int slot)
+{
+        if ((int)cam_slot_type(cam, slot) == SLOT_COMP_2) {
+                return (int64_t)cam_get_slot_comp_2(cam, slot);
+        }
+
+        bool is_signed;
+        int scale;
+        cam_comp_4_t value = cam_get_slot_comp_4(cam, slot, &is_signed, &scale);
+        for (; scale > 0; --scale) {
+                value /= 10;
+        }
+        return value;
+}
+
+void add_program(
+        vector<cam_foreign_program_t> &programs, char *name, void (*func)(struct cam_s*, int, void*), void *ud)
+{
+        cam_foreign_program_t p;
+        p.module  = system_module;
+        p.program = name;
+        p.func    = func;
+        p.ud      = ud;
+        programs.push_back(p);
+}
+
+} } // namespace cam::native
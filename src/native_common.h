@@ -0,0 +1,101 @@
+#ifndef CAM_NATIVE_COMMON_H
+#define CAM_NATIVE_COMMON_H
+
+#include <cam.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace cam { namespace native {
+
+// mirrors `SlotType` in cam.ts
+enum slot_type
+{
+        SLOT_UNKNOWN,
+        SLOT_COMP_2,
+        SLOT_COMP_4,
+        SLOT_PROGRAM,
+        SLOT_DISPLAY
+};
+
+// 10^0 to 10^18, the powers of ten that fit in an int64_t
+extern const int64_t pow10_table[19];
+
+// int64 arithmetic that reports overflow instead of wrapping, true if
+// `a op b` didn't fit, `*r` is then unspecified. The builtins are GCC and
+// Clang only.
+static inline bool add_overflow(int64_t a, int64_t b, int64_t *r)
+{
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_add_overflow(a, b, r);
+#else
+        if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) {
+                return true;
+        }
+        *r = a + b;
+        return false;
+#endif
+}
+
+static inline bool sub_overflow(int64_t a, int64_t b, int64_t *r)
+{
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_sub_overflow(a, b, r);
+#else
+        if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) {
+                return true;
+        }
+        *r = a - b;
+        return false;
+#endif
+}
+
+static inline bool mul_overflow(int64_t a, int64_t b, int64_t *r)
+{
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_mul_overflow(a, b, r);
+#else
+        const bool overflow = a > 0 ?
+                (b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a) :
+                (b > 0 ? a < INT64_MIN / b : a != 0 && b < INT64_MAX / a);
+        if (overflow) {
+                return true;
+        }
+        *r = a * b;
+        return false;
+#endif
+}
+
+// comp3.cc
+bool comp3_unpack(const uint8_t *p, int n, bool *is_signed, cam_comp_4_t *value);
+bool comp3_pack  (uint8_t *p, int n, bool is_signed, cam_comp_4_t value);
+
+// Integer part of a Comp2 or Comp4 slot, the fraction is truncated.
+int64_t get_slot_integer(struct cam_s *cam, int slot);
+
+// Appends the foreign program SYSTEM:`name`, which must outlive the
+// instances it's added to.
+void add_program(
+        std::vector<cam_foreign_program_t> &programs, char *name, void (*func)(struct cam_s*, int, void*),
+        void *ud = nullptr);
+
+// The open sequential files of one instance, dropping it flushes and
+// closes them and joins their threads.
+struct sequential_files;
+sequential_files* sequential_files_new();
+void sequential_files_drop(sequential_files *files);
+
+// The open indexed files of one instance, dropping it closes them.
+struct indexed_files;
+indexed_files* indexed_files_new();
+void indexed_files_drop(indexed_files *files);
+
+// native SYSTEM programs, the file ones POSIX only and built where
+// CAM_NATIVE_FILES is defined
+void SortPrograms          (std::vector<cam_foreign_program_t> &programs);
+void IndexedFilePrograms   (std::vector<cam_foreign_program_t> &programs, indexed_files *files);
+void SequentialFilePrograms(std::vector<cam_foreign_program_t> &programs, sequential_files *files);
+
+} } // namespace cam::native
+
+#endif // CAM_NATIVE_COMMON_H
@@ -0,0 +1,52 @@
+const native = require('bindings')('cam-native')
+import { CamNative } from './cam'
+import { ErrorCode } from './error'
+
+export enum FieldType
+{
+        Display,
+        Zoned,
+        Binary,
+        Packed
+}
+
+export interface Field
+{
+        type: FieldType
+        offset: number
+        length: number
+        scale?: number
+        isSigned?: boolean
+}
+
+export interface RecordLayout
+{
+        recordLength: number
+        ebcdic?: boolean
+        fields: Field[]
+}
+
+export interface RecordCodecNative
+{
+        decode(cam: CamNative, buf: Buffer, firstRecord: number, count: number, firstSlot: number): ErrorCode
+        encode(cam: CamNative, firstSlot: number, buf: Buffer, firstRecord: number, count: number): ErrorCode
+}
+
+export var RecordCodecNative: {
+        new(layout: RecordLayout): RecordCodecNative
+} = native.RecordCodecNative
+
+// Fixed-width record codec, each record maps to one slot per field:
+// Display fields to Display slots and numeric fields to Comp4 slots.
+// A bad layout throws a TypeError or RangeError, encoding a value that
+// doesn't fit its field fails with `BadArguments`.
+export class RecordCodec extends RecordCodecNative
+{
+        readonly layout: RecordLayout
+
+        constructor(layout: RecordLayout)
+        {
+                super(layout)
+                this.layout = layout
+        }
+}
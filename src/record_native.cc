@@ -0,0 +1,704 @@
+#include "native_common.h"
+
+#include <node_api.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define DECLARE_NAPI_METHOD(name, func) { name, 0, func, 0, 0, 0, napi_default, 0 }
+
+namespace cam { namespace native {
+
+struct cam_s* CamUnwrap(napi_env env, napi_value cam);
+
+
+// code page 037 <-> ISO-8859-1
+static const uint8_t ebcdic_to_ascii[256] = {
+        0x00, 0x01, 0x02, 0x03, 0x9C, 0x09, 0x86, 0x7F, 0x97, 0x8D, 0x8E, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+        0x10, 0x11, 0x12, 0x13, 0x9D, 0x85, 0x08, 0x87, 0x18, 0x19, 0x92, 0x8F, 0x1C, 0x1D, 0x1E, 0x1F,
+        0x80, 0x81, 0x82, 0x83, 0x84, 0x0A, 0x17, 0x1B, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x05, 0x06, 0x07,
+        0x90, 0x91, 0x16, 0x93, 0x94, 0x95, 0x96, 0x04, 0x98, 0x99, 0x9A, 0x9B, 0x14, 0x15, 0x9E, 0x1A,
+        0x20, 0xA0, 0xE2, 0xE4, 0xE0, 0xE1, 0xE3, 0xE5, 0xE7, 0xF1, 0xA2, 0x2E, 0x3C, 0x28, 0x2B, 0x7C,
+        0x26, 0xE9, 0xEA, 0xEB, 0xE8, 0xED, 0xEE, 0xEF, 0xEC, 0xDF, 0x21, 0x24, 0x2A, 0x29, 0x3B, 0xAC,
+        0x2D, 0x2F, 0xC2, 0xC4, 0xC0, 0xC1, 0xC3, 0xC5, 0xC7, 0xD1, 0xA6, 0x2C, 0x25, 0x5F, 0x3E, 0x3F,
+        0xF8, 0xC9, 0xCA, 0xCB, 0xC8, 0xCD, 0xCE, 0xCF, 0xCC, 0x60, 0x3A, 0x23, 0x40, 0x27, 0x3D, 0x22,
+        0xD8, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0xAB, 0xBB, 0xF0, 0xFD, 0xFE, 0xB1,
+        0xB0, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F, 0x70, 0x71, 0x72, 0xAA, 0xBA, 0xE6, 0xB8, 0xC6, 0xA4,
+        0xB5, 0x7E, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0xA1, 0xBF, 0xD0, 0xDD, 0xDE, 0xAE,
+        0x5E, 0xA3, 0xA5, 0xB7, 0xA9, 0xA7, 0xB6, 0xBC, 0xBD, 0xBE, 0x5B, 0x5D, 0xAF, 0xA8, 0xB4, 0xD7,
+        0x7B, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0xAD, 0xF4, 0xF6, 0xF2, 0xF3, 0xF5,
+        0x7D, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F, 0x50, 0x51, 0x52, 0xB9, 0xFB, 0xFC, 0xF9, 0xFA, 0xFF,
+        0x5C, 0xF7, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0xB2, 0xD4, 0xD6, 0xD2, 0xD3, 0xD5,
+        0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0xB3, 0xDB, 0xDC, 0xD9, 0xDA, 0x9F
+};
+
+static const uint8_t ascii_to_ebcdic[256] = {
+        0x00, 0x01, 0x02, 0x03, 0x37, 0x2D, 0x2E, 0x2F, 0x16, 0x05, 0x25, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+        0x10, 0x11, 0x12, 0x13, 0x3C, 0x3D, 0x32, 0x26, 0x18, 0x19, 0x3F, 0x27, 0x1C, 0x1D, 0x1E, 0x1F,
+        0x40, 0x5A, 0x7F, 0x7B, 0x5B, 0x6C, 0x50, 0x7D, 0x4D, 0x5D, 0x5C, 0x4E, 0x6B, 0x60, 0x4B, 0x61,
+        0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0x7A, 0x5E, 0x4C, 0x7E, 0x6E, 0x6F,
+        0x7C, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6,
+        0xD7, 0xD8, 0xD9, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xBA, 0xE0, 0xBB, 0xB0, 0x6D,
+        0x79, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96,
+        0x97, 0x98, 0x99, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xC0, 0x4F, 0xD0, 0xA1, 0x07,
+        0x20, 0x21, 0x22, 0x23, 0x24, 0x15, 0x06, 0x17, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x09, 0x0A, 0x1B,
+        0x30, 0x31, 0x1A, 0x33, 0x34, 0x35, 0x36, 0x08, 0x38, 0x39, 0x3A, 0x3B, 0x04, 0x14, 0x3E, 0xFF,
+        0x41, 0xAA, 0x4A, 0xB1, 0x9F, 0xB2, 0x6A, 0xB5, 0xBD, 0xB4, 0x9A, 0x8A, 0x5F, 0xCA, 0xAF, 0xBC,
+        0x90, 0x8F, 0xEA, 0xFA, 0xBE, 0xA0, 0xB6, 0xB3, 0x9D, 0xDA, 0x9B, 0x8B, 0xB7, 0xB8, 0xB9, 0xAB,
+        0x64, 0x65, 0x62, 0x66, 0x63, 0x67, 0x9E, 0x68, 0x74, 0x71, 0x72, 0x73, 0x78, 0x75, 0x76, 0x77,
+        0xAC, 0x69, 0xED, 0xEE, 0xEB, 0xEF, 0xEC, 0xBF, 0x80, 0xFD, 0xFE, 0xFB, 0xFC, 0xAD, 0xAE, 0x59,
+        0x44, 0x45, 0x42, 0x46, 0x43, 0x47, 0x9C, 0x48, 0x54, 0x51, 0x52, 0x53, 0x58, 0x55, 0x56, 0x57,
+        0x8C, 0x49, 0xCD, 0xCE, 0xCB, 0xCF, 0xCC, 0xE1, 0x70, 0xDD, 0xDE, 0xDB, 0xDC, 0x8D, 0x8E, 0xDF
+};
+
+// mirrors `FieldType` in record.ts
+enum field_type
+{
+        FIELD_DISPLAY,
+        FIELD_ZONED,
+        FIELD_BINARY,
+        FIELD_PACKED
+};
+
+// tags wrapped instances, so that an unwrap can tell a codec from any
+// other object
+static const napi_type_tag record_codec_type_tag = {
+        0x47237870ec1b4df9ULL, 0xbafcd45d554291c5ULL
+};
+
+struct record_field
+{
+        int type;
+        int offset;
+        int length;
+        int scale;
+        bool is_signed;
+};
+
+static bool is_undefined(napi_env env, napi_value v)
+{
+        napi_valuetype t;
+        napi_status status = napi_typeof(env, v, &t);
+        assert(status == napi_ok);
+        return t == napi_undefined;
+}
+
+static void throw_layout_error(napi_env env, bool type_error, const string &what)
+{
+        const string msg = "bad record layout: " + what;
+        if (type_error) {
+                napi_throw_type_error(env, nullptr, msg.c_str());
+        } else {
+                napi_throw_range_error(env, nullptr, msg.c_str());
+        }
+}
+
+// The getters below leave a pending TypeError and return false if the
+// property is set to a value of the wrong type.
+
+static bool get_named_int32(napi_env env, napi_value obj, const char *name, int32_t def, int32_t *value)
+{
+        napi_status status;
+
+        napi_value v;
+        status = napi_get_named_property(env, obj, name, &v);
+        assert(status == napi_ok);
+        if (is_undefined(env, v)) {
+                *value = def;
+                return true;
+        }
+
+        status = napi_get_value_int32(env, v, value);
+        if (status == napi_number_expected) {
+                throw_layout_error(env, true, string(name) + " must be a number");
+                return false;
+        }
+        assert(status == napi_ok);
+        return true;
+}
+
+static bool get_named_bool(napi_env env, napi_value obj, const char *name, bool def, bool *value)
+{
+        napi_status status;
+
+        napi_value v;
+        status = napi_get_named_property(env, obj, name, &v);
+        assert(status == napi_ok);
+        if (is_undefined(env, v)) {
+                *value = def;
+                return true;
+        }
+
+        status = napi_get_value_bool(env, v, value);
+        if (status == napi_boolean_expected) {
+                throw_layout_error(env, true, string(name) + " must be a boolean");
+                return false;
+        }
+        assert(status == napi_ok);
+        return true;
+}
+
+// Leaves a pending TypeError or RangeError and returns false if field `i`
+// can't be decoded or encoded.
+// False with a pending RangeError if `first_record` or `count` is
+// negative, the records themselves are checked against the buffer.
+static bool check_record_range(napi_env env, int32_t first_record, int32_t count)
+{
+        if (first_record < 0 || count < 0) {
+                napi_throw_range_error(env, nullptr, "first record and count must not be negative");
+                return false;
+        }
+        return true;
+}
+
+static bool check_field(napi_env env, const record_field &f, uint32_t i, int record_length)
+{
+        const string field = "field " + to_string(i) + " ";
+        if (f.type < FIELD_DISPLAY || f.type > FIELD_PACKED) {
+                throw_layout_error(env, true, field + "has an unknown type");
+                return false;
+        }
+        if (f.offset < 0 || f.length <= 0 || f.length > record_length - f.offset) {
+                throw_layout_error(env, false, field + "doesn't lie within the record");
+                return false;
+        }
+        if (f.scale < 0 || f.scale > 18) {
+                throw_layout_error(env, false, field + "scale must be within 0 and 18");
+                return false;
+        }
+
+        bool length_ok = true;
+        switch (f.type) {
+        case FIELD_ZONED:
+                length_ok = f.length <= 18;
+                break;
+        case FIELD_BINARY:
+                length_ok = f.length == 2 || f.length == 4 || f.length == 8;
+                break;
+        case FIELD_PACKED:
+                length_ok = f.length <= 10;
+                break;
+        }
+        if (!length_ok) {
+                throw_layout_error(env, false, field + "length doesn't suit its type");
+                return false;
+        }
+
+        return true;
+}
+
+static void transcode(uint8_t *dst, const uint8_t *src, int n, const uint8_t *table)
+{
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+                dst[i    ] = table[src[i    ]];
+                dst[i + 1] = table[src[i + 1]];
+                dst[i + 2] = table[src[i + 2]];
+                dst[i + 3] = table[src[i + 3]];
+        }
+        for (; i < n; ++i) {
+                dst[i] = table[src[i]];
+        }
+}
+
+// Parses `n` (at most 18) zoned digits, only the digit nibbles are looked
+// at except for the sign zone of the last byte.
+static bool parse_zoned(const uint8_t *p, int n, bool ebcdic, bool is_signed, cam_comp_4_t *value)
+{
+        uint64_t v = 0;
+        int i = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // 8 digits at a time, the first digit lands in the lowest byte
+        for (; i + 8 <= n; i += 8) {
+                uint64_t chunk;
+                memcpy(&chunk, p + i, 8);
+                chunk &= 0x0F0F0F0F0F0F0F0FULL;
+                if ((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) {
+                        return false;
+                }
+                chunk = (chunk * 10    + (chunk >> 8 )) & 0x00FF00FF00FF00FFULL;
+                chunk = (chunk * 100   + (chunk >> 16)) & 0x0000FFFF0000FFFFULL;
+                chunk = (chunk * 10000 + (chunk >> 32)) & 0x00000000FFFFFFFFULL;
+                v = v * 100000000 + chunk;
+        }
+#endif
+
+        for (; i < n; ++i) {
+                const int d = p[i] & 0x0F;
+                if (d > 9) {
+                        return false;
+                }
+                v = v * 10 + d;
+        }
+
+        const int zone = p[n - 1] & 0xF0;
+        const bool negative = is_signed && (ebcdic ? zone == 0xD0 || zone == 0xB0 : zone == 0x70);
+        *value = negative ? -(cam_comp_4_t)v : (cam_comp_4_t)v;
+        return true;
+}
+
+// False if `value` has more than `n` digits or is negative and unsigned,
+// the bytes are then left undefined.
+static bool format_zoned(uint8_t *p, int n, bool ebcdic, bool is_signed, cam_comp_4_t value)
+{
+        const bool negative = value < 0;
+        if (negative && !is_signed) {
+                return false;
+        }
+        uint64_t v = negative ? 0 - (uint64_t)value : (uint64_t)value;
+
+        const uint8_t zone = ebcdic ? 0xF0 : 0x30;
+        for (int i = n - 1; i >= 0; --i) {
+                p[i] = zone | (uint8_t)(v % 10);
+                v /= 10;
+        }
+
+        if (is_signed) {
+                const uint8_t sign = ebcdic ? (negative ? 0xD0 : 0xC0) : (negative ? 0x70 : 0x30);
+                p[n - 1] = (p[n - 1] & 0x0F) | sign;
+        }
+
+        return v == 0;
+}
+
+static cam_comp_4_t parse_binary(const uint8_t *p, int n, bool is_signed)
+{
+        uint64_t v = 0;
+        for (int i = 0; i < n; ++i) {
+                v = (v << 8) | p[i];
+        }
+
+        if (is_signed && n < 8 && (p[0] & 0x80)) {
+                v |= ~0ULL << (n * 8);
+        }
+
+        return (cam_comp_4_t)v;
+}
+
+// False if `value` doesn't fit in `n` bytes, or is negative and unsigned.
+static bool format_binary(uint8_t *p, int n, bool is_signed, cam_comp_4_t value)
+{
+        if (n < 8) {
+                const int bits = n * 8;
+                const cam_comp_4_t lo = is_signed ? -((cam_comp_4_t)1 << (bits - 1)) : 0;
+                const cam_comp_4_t hi = is_signed ? ((cam_comp_4_t)1 << (bits - 1)) - 1 : ((cam_comp_4_t)1 << bits) - 1;
+                if (value < lo || value > hi) {
+                        return false;
+                }
+        } else if (!is_signed && value < 0) {
+                return false;
+        }
+
+        uint64_t v = (uint64_t)value;
+        for (int i = n - 1; i >= 0; --i) {
+                p[i] = (uint8_t)v;
+                v >>= 8;
+        }
+        return true;
+}
+
+// Reads a numeric slot at `scale` decimal places, dropped digits are
+// rounded half away from zero whether the slot is a Comp2 or a Comp4.
+// False if the value doesn't fit in 64 bits.
+static bool get_slot_scaled(struct cam_s *cam, int slot, int scale, cam_comp_4_t *value)
+{
+        if ((int)cam_slot_type(cam, slot) == SLOT_COMP_2) {
+                const double v = round(cam_get_slot_comp_2(cam, slot) * (double)pow10_table[scale]);
+                // 2^63, the first double out of range
+                if (!(v >= -9223372036854775808.0 && v < 9223372036854775808.0)) {
+                        return false;
+                }
+                *value = (cam_comp_4_t)v;
+                return true;
+        }
+
+        bool is_signed;
+        int slot_scale;
+        const cam_comp_4_t v = cam_get_slot_comp_4(cam, slot, &is_signed, &slot_scale);
+        if (slot_scale <= scale) {
+                return !mul_overflow(v, pow10_table[scale - slot_scale], value);
+        }
+
+        const int64_t d = pow10_table[slot_scale - scale];
+        const int64_t q = v / d, r = v % d;
+        if (r >= d - r) {
+                *value = q + 1;
+        } else if (-r >= d + r) {
+                *value = q - 1;
+        } else {
+                *value = q;
+        }
+        return true;
+}
+
+class RecordCodec
+{
+private:
+        RecordCodec(napi_env env)
+                : _env(env)
+                , _wrapper(nullptr)
+                , _record_length(0)
+                , _ebcdic(false)
+        {
+                // nop
+        }
+
+       ~RecordCodec()
+        {
+                napi_delete_reference(_env, _wrapper);
+        }
+
+        static napi_value New(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 1;
+                napi_value jsthis, argv[1];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 1);
+
+                // the layout is checked before anything is wrapped
+                int32_t record_length;
+                bool ebcdic;
+                if (!get_named_int32(env, argv[0], "recordLength", 0, &record_length) ||
+                    !get_named_bool(env, argv[0], "ebcdic", false, &ebcdic)) {
+                        return nullptr;
+                }
+                if (record_length <= 0) {
+                        throw_layout_error(env, false, "recordLength must be positive");
+                        return nullptr;
+                }
+
+                napi_value fields;
+                status = napi_get_named_property(env, argv[0], "fields", &fields);
+                assert(status == napi_ok);
+
+                uint32_t num_fields;
+                status = napi_get_array_length(env, fields, &num_fields);
+                if (status == napi_array_expected) {
+                        throw_layout_error(env, true, "fields must be an array");
+                        return nullptr;
+                }
+                assert(status == napi_ok);
+
+                vector<record_field> layout(num_fields);
+                for (uint32_t i = 0; i < num_fields; ++i) {
+                        napi_value fv;
+                        status = napi_get_element(env, fields, i, &fv);
+                        assert(status == napi_ok);
+
+                        auto &f = layout[i];
+                        if (!get_named_int32(env, fv, "type", FIELD_DISPLAY, &f.type) ||
+                            !get_named_int32(env, fv, "offset", 0, &f.offset) ||
+                            !get_named_int32(env, fv, "length", 0, &f.length) ||
+                            !get_named_int32(env, fv, "scale", 0, &f.scale) ||
+                            !get_named_bool(env, fv, "isSigned", false, &f.is_signed) ||
+                            !check_field(env, f, i, record_length)) {
+                                return nullptr;
+                        }
+                }
+
+                RecordCodec *obj = new RecordCodec(env);
+                status = napi_wrap(env, jsthis, (void*)obj, &RecordCodec::Destructor, nullptr, &obj->_wrapper);
+                assert(status == napi_ok);
+                status = napi_type_tag_object(env, jsthis, &record_codec_type_tag);
+                assert(status == napi_ok);
+
+                obj->_record_length = record_length;
+                obj->_ebcdic = ebcdic;
+                obj->_fields = move(layout);
+
+                return jsthis;
+        }
+
+        // Decodes `count` records starting at `first_record`, each into
+        // consecutive slots starting at `first_slot`, one slot per field.
+        cam_error_t DecodeRecords(struct cam_s *cam, const uint8_t *buf, size_t buf_len, int first_record, int count, int first_slot)
+        {
+                if ((size_t)first_record + (size_t)count > buf_len / _record_length) {
+                        return CEC_BAD_ARGUMENTS;
+                }
+
+                const int num_fields = (int)_fields.size();
+                cam_ensure_slots(cam, first_slot + count * num_fields);
+
+                for (int r = 0; r < count; ++r) {
+                        const uint8_t *record = buf + ((size_t)first_record + r) * _record_length;
+                        for (int i = 0; i < num_fields; ++i) {
+                                auto &f = _fields[i];
+                                const int slot = first_slot + r * num_fields + i;
+                                const uint8_t *p = record + f.offset;
+                                switch (f.type) {
+                                case FIELD_DISPLAY: {
+                                        char *str = cam_set_slot_display(cam, slot, nullptr, f.length);
+                                        if (_ebcdic) {
+                                                transcode((uint8_t*)str, p, f.length, ebcdic_to_ascii);
+                                        } else {
+                                                memcpy(str, p, f.length);
+                                        }
+                                        str[f.length] = '\0';
+                                        break; }
+                                case FIELD_ZONED: {
+                                        cam_comp_4_t value;
+                                        if (!parse_zoned(p, f.length, _ebcdic, f.is_signed, &value)) {
+                                                return CEC_BAD_ARGUMENTS;
+                                        }
+                                        cam_set_slot_comp_4(cam, slot, f.is_signed, f.scale, value);
+                                        break; }
+                                case FIELD_BINARY:
+                                        cam_set_slot_comp_4(cam, slot, f.is_signed, f.scale, parse_binary(p, f.length, f.is_signed));
+                                        break;
+                                case FIELD_PACKED: {
+                                        bool is_signed;
+                                        cam_comp_4_t value;
+                                        if (!comp3_unpack(p, f.length, &is_signed, &value)) {
+                                                return CEC_BAD_ARGUMENTS;
+                                        }
+                                        cam_set_slot_comp_4(cam, slot, is_signed, f.scale, value);
+                                        break; }
+                                default:
+                                        return CEC_BAD_ARGUMENTS;
+                                }
+                        }
+                }
+
+                return CEC_SUCCESS;
+        }
+
+        // Inverse of `DecodeRecords`, display fields are space padded. Fails
+        // with `CEC_BAD_ARGUMENTS` on a value that doesn't fit its field.
+        cam_error_t EncodeRecords(struct cam_s *cam, int first_slot, uint8_t *buf, size_t buf_len, int first_record, int count)
+        {
+                if ((size_t)first_record + (size_t)count > buf_len / _record_length) {
+                        return CEC_BAD_ARGUMENTS;
+                }
+
+                const int num_fields = (int)_fields.size();
+                for (int r = 0; r < count; ++r) {
+                        uint8_t *record = buf + ((size_t)first_record + r) * _record_length;
+                        for (int i = 0; i < num_fields; ++i) {
+                                auto &f = _fields[i];
+                                const int slot = first_slot + r * num_fields + i;
+                                uint8_t *p = record + f.offset;
+                                switch (f.type) {
+                                case FIELD_DISPLAY: {
+                                        int length;
+                                        const char *str = cam_get_slot_display(cam, slot, &length);
+                                        length = length < f.length ? length : f.length;
+                                        if (_ebcdic) {
+                                                transcode(p, (const uint8_t*)str, length, ascii_to_ebcdic);
+                                        } else {
+                                                memcpy(p, str, length);
+                                        }
+                                        memset(p + length, _ebcdic ? 0x40 : ' ', f.length - length);
+                                        break; }
+                                case FIELD_ZONED:
+                                case FIELD_BINARY:
+                                case FIELD_PACKED: {
+                                        cam_comp_4_t value;
+                                        if (!get_slot_scaled(cam, slot, f.scale, &value)) {
+                                                return CEC_BAD_ARGUMENTS;
+                                        }
+                                        const bool fits =
+                                                f.type == FIELD_ZONED  ? format_zoned(p, f.length, _ebcdic, f.is_signed, value) :
+                                                f.type == FIELD_BINARY ? format_binary(p, f.length, f.is_signed, value) :
+                                                                         comp3_pack(p, f.length, f.is_signed, value);
+                                        if (!fits) {
+                                                return CEC_BAD_ARGUMENTS;
+                                        }
+                                        break; }
+                                default:
+                                        return CEC_BAD_ARGUMENTS;
+                                }
+                        }
+                }
+
+                return CEC_SUCCESS;
+        }
+
+        static napi_value Decode(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 5;
+                napi_value jsthis, argv[5];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 5);
+
+                RecordCodec *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                struct cam_s *cam = CamUnwrap(env, argv[0]);
+                if (!cam) {
+                        return nullptr;
+                }
+
+                uint8_t *buf;
+                size_t buf_len;
+                status = napi_get_buffer_info(env, argv[1], (void**)&buf, &buf_len);
+                assert(status == napi_ok);
+
+                int32_t first_record, count, first_slot;
+                status = napi_get_value_int32(env, argv[2], &first_record);
+                assert(status == napi_ok);
+                status = napi_get_value_int32(env, argv[3], &count);
+                assert(status == napi_ok);
+                if (!check_record_range(env, first_record, count)) {
+                        return nullptr;
+                }
+                status = napi_get_value_int32(env, argv[4], &first_slot);
+                assert(status == napi_ok);
+
+                napi_value ret;
+                cam_error_t ec = obj->DecodeRecords(cam, buf, buf_len, first_record, count, first_slot);
+                status = napi_create_int32(env, ec, &ret);
+                return ret;
+        }
+
+        static napi_value Encode(napi_env env, napi_callback_info info)
+        {
+                napi_status status;
+
+                size_t argc = 5;
+                napi_value jsthis, argv[5];
+                status = napi_get_cb_info(env, info, &argc, argv, &jsthis, nullptr);
+                assert(status == napi_ok && argc == 5);
+
+                RecordCodec *obj;
+                status = napi_unwrap(env, jsthis, (void**)&obj);
+                assert(status == napi_ok);
+
+                struct cam_s *cam = CamUnwrap(env, argv[0]);
+                if (!cam) {
+                        return nullptr;
+                }
+
+                int32_t first_slot;
+                status = napi_get_value_int32(env, argv[1], &first_slot);
+                assert(status == napi_ok);
+
+                uint8_t *buf;
+                size_t buf_len;
+                status = napi_get_buffer_info(env, argv[2], (void**)&buf, &buf_len);
+                assert(status == napi_ok);
+
+                int32_t first_record, count;
+                status = napi_get_value_int32(env, argv[3], &first_record);
+                assert(status == napi_ok);
+                status = napi_get_value_int32(env, argv[4], &count);
+                assert(status == napi_ok);
+                if (!check_record_range(env, first_record, count)) {
+                        return nullptr;
+                }
+
+                napi_value ret;
+                cam_error_t ec = obj->EncodeRecords(cam, first_slot, buf, buf_len, first_record, count);
+                status = napi_create_int32(env, ec, &ret);
+                return ret;
+        }
+
+        napi_env _env;
+        napi_ref _wrapper;
+        int _record_length;
+        bool _ebcdic;
+        vector<record_field> _fields;
+
+public:
+        static void Init(napi_env env, napi_value exports)
+        {
+                napi_status status;
+
+                const napi_property_descriptor props[] = {
+                        DECLARE_NAPI_METHOD("decode", &Decode),
+                        DECLARE_NAPI_METHOD("encode", &Encode)
+                };
+
+                const size_t num_props = sizeof(props) / sizeof(props[0]);
+
+                napi_value cons;
+                status = napi_define_class(
+                        env, "RecordCodecNative", NAPI_AUTO_LENGTH, &New, nullptr, num_props, props, &cons);
+                assert(status == napi_ok);
+
+                status = napi_set_named_property(env, exports, "RecordCodecNative", cons);
+                assert(status == napi_ok);
+        }
+
+        static void Destructor(napi_env env, void *obj, void *)
+        {
+                ((RecordCodec*)obj)->~RecordCodec();
+        }
+
+        friend int RecordCodecLength(const RecordCodec *codec);
+        friend int RecordCodecNumFields(const RecordCodec *codec);
+        friend cam_error_t RecordCodecDecode(
+                RecordCodec *codec, struct cam_s *cam, const uint8_t *buf, size_t buf_len,
+                int first_record, int count, int first_slot);
+        friend cam_error_t RecordCodecEncode(
+                RecordCodec *codec, struct cam_s *cam, int first_slot, uint8_t *buf, size_t buf_len,
+                int first_record, int count);
+};
+
+void RecordInit(napi_env env, napi_value exports)
+{
+        RecordCodec::Init(env, exports);
+}
+
+// nullptr with a pending TypeError if `codec` isn't a RecordCodecNative
+RecordCodec* RecordCodecUnwrap(napi_env env, napi_value codec)
+{
+        napi_status status;
+
+        bool is_codec = false;
+        napi_valuetype t;
+        status = napi_typeof(env, codec, &t);
+        assert(status == napi_ok);
+        if (t == napi_object) {
+                status = napi_check_object_type_tag(env, codec, &record_codec_type_tag, &is_codec);
+                assert(status == napi_ok);
+        }
+        if (!is_codec) {
+                napi_throw_type_error(env, nullptr, "expected a RecordCodec");
+                return nullptr;
+        }
+
+        RecordCodec *obj;
+        status = napi_unwrap(env, codec, (void**)&obj);
+        assert(status == napi_ok);
+        return obj;
+}
+
+int RecordCodecLength(const RecordCodec *codec)
+{
+        return codec->_record_length;
+}
+
+int RecordCodecNumFields(const RecordCodec *codec)
+{
+        return (int)codec->_fields.size();
+}
+
+cam_error_t RecordCodecDecode(
+        RecordCodec *codec, struct cam_s *cam, const uint8_t *buf, size_t buf_len,
+        int first_record, int count, int first_slot)
+{
+        return codec->DecodeRecords(cam, buf, buf_len, first_record, count, first_slot);
+}
+
+cam_error_t RecordCodecEncode(
+        RecordCodec *codec, struct cam_s *cam, int first_slot, uint8_t *buf, size_t buf_len,
+        int first_record, int count)
+{
+        return codec->EncodeRecords(cam, first_slot, buf, buf_len, first_record, count);
+}
+
+} } // namespace cam::native
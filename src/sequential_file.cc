@@ -0,0 +1,547 @@
+#include "native_common.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace cam { namespace native {
+
+// COBOL file status codes
+enum file_status
+{
+        FS_SUCCESS        = 0,
+        FS_END_OF_FILE    = 10,
+        FS_IO_ERROR       = 30,
+        FS_NOT_FOUND_FILE = 35,
+        FS_BAD_ATTRIBUTES = 39,
+        FS_NOT_OPEN       = 42,
+        FS_WRONG_MODE     = 47
+};
+
+static const size_t SEQ_BUFFER_SIZE  = 1 << 20;
+static const size_t SEQ_BUFFER_ALIGN = 4096;
+static const int    SEQ_NUM_BUFFERS  = 4;
+
+// variable length records are prefixed by a mainframe style record
+// descriptor word: big endian length including the RDW, then two zero bytes
+static const size_t RDW_LENGTH = 4;
+static const size_t MAX_VARIABLE_RECORD = 32756;
+
+struct io_buffer
+{
+        uint8_t *data;
+        size_t length;
+};
+
+// Buffers move between the caller and the background thread through two
+// queues: an input file's thread fills `free` buffers and queues them on
+// `full`, an output file's thread drains `full` and gives them back.
+struct sequential_file
+{
+        // flushes and joins the thread if still open
+       ~sequential_file();
+
+        // held by the caller for a whole operation, `m` only guards the
+        // state shared with the thread
+        mutex op_lock;
+        int fd = -1;
+        bool output = false;
+        bool variable = false;
+        uint32_t record_length = 0;
+
+        vector<unique_ptr<uint8_t, decltype(&free)>> storage;
+
+        mutex m;
+        condition_variable cv;
+        deque<io_buffer> free_buffers;
+        deque<io_buffer> full_buffers;
+        bool stop = false;
+        bool done = false; // input: the thread hit end of file or an error
+        int error = 0;
+        thread worker;
+
+        // buffer owned by the caller, with `pos` the next byte to read or write
+        io_buffer current = {nullptr, 0};
+        bool has_current = false;
+        size_t pos = 0;
+};
+
+static void read_ahead(sequential_file *f)
+{
+        for (;;) {
+                io_buffer b;
+                {
+                        unique_lock<mutex> lock(f->m);
+                        f->cv.wait(lock, [f] { return f->stop || !f->free_buffers.empty(); });
+                        if (f->stop) {
+                                return;
+                        }
+                        b = f->free_buffers.front();
+                        f->free_buffers.pop_front();
+                }
+
+                b.length = 0;
+                int error = 0;
+                while (b.length < SEQ_BUFFER_SIZE) {
+                        ssize_t n = read(f->fd, b.data + b.length, SEQ_BUFFER_SIZE - b.length);
+                        if (n < 0 && errno == EINTR) {
+                                continue;
+                        }
+                        if (n < 0) {
+                                error = errno;
+                                break;
+                        }
+                        if (n == 0) {
+                                break;
+                        }
+                        b.length += n;
+                }
+
+                lock_guard<mutex> lock(f->m);
+                if (b.length > 0) {
+                        f->full_buffers.push_back(b);
+                } else {
+                        f->free_buffers.push_back(b);
+                }
+                if (error || b.length < SEQ_BUFFER_SIZE) {
+                        f->error = error;
+                        f->done = true;
+                        f->cv.notify_all();
+                        return;
+                }
+                f->cv.notify_all();
+        }
+}
+
+// Once a write failed the rest of the buffers are only given back, so
+// that the file doesn't get records past a hole.
+static void write_behind(sequential_file *f)
+{
+        for (;;) {
+                io_buffer b;
+                bool failed;
+                {
+                        unique_lock<mutex> lock(f->m);
+                        f->cv.wait(lock, [f] { return f->stop || !f->full_buffers.empty(); });
+                        if (f->full_buffers.empty()) {
+                                return;
+                        }
+                        b = f->full_buffers.front();
+                        f->full_buffers.pop_front();
+                        failed = f->error != 0;
+                }
+
+                size_t written = 0;
+                int error = 0;
+                while (!failed && written < b.length) {
+                        ssize_t n = write(f->fd, b.data + written, b.length - written);
+                        if (n < 0 && errno == EINTR) {
+                                continue;
+                        }
+                        if (n < 0) {
+                                error = errno;
+                                break;
+                        }
+                        written += n;
+                }
+
+                lock_guard<mutex> lock(f->m);
+                if (error && !f->error) {
+                        f->error = error;
+                }
+                f->free_buffers.push_back(b);
+                f->cv.notify_all();
+        }
+}
+
+// Takes the next filled buffer, false at end of file or on error.
+static bool next_input_buffer(sequential_file &f)
+{
+        unique_lock<mutex> lock(f.m);
+        if (f.has_current) {
+                f.free_buffers.push_back(f.current);
+                f.has_current = false;
+                f.cv.notify_all();
+        }
+        f.cv.wait(lock, [&f] { return f.done || !f.full_buffers.empty(); });
+        if (f.full_buffers.empty()) {
+                return false;
+        }
+        f.current = f.full_buffers.front();
+        f.full_buffers.pop_front();
+        f.has_current = true;
+        f.pos = 0;
+        return true;
+}
+
+// Hands the current buffer to the writer and takes a free one.
+static void next_output_buffer(sequential_file &f)
+{
+        unique_lock<mutex> lock(f.m);
+        if (f.has_current) {
+                f.current.length = f.pos;
+                f.full_buffers.push_back(f.current);
+                f.has_current = false;
+                f.cv.notify_all();
+        }
+        f.cv.wait(lock, [&f] { return !f.free_buffers.empty(); });
+        f.current = f.free_buffers.front();
+        f.free_buffers.pop_front();
+        f.has_current = true;
+        f.pos = 0;
+}
+
+// False at end of file or on an error, otherwise there is a byte to read.
+static bool input_left(sequential_file &f)
+{
+        return (f.has_current && f.pos < f.current.length) || next_input_buffer(f);
+}
+
+// Copies `n` bytes, records may straddle buffers; returns the number of
+// bytes copied, less than `n` only at end of file.
+static size_t read_bytes(sequential_file &f, uint8_t *dst, size_t n)
+{
+        size_t copied = 0;
+        while (copied < n) {
+                if (!input_left(f)) {
+                        break;
+                }
+                const size_t chunk = min(n - copied, f.current.length - f.pos);
+                memcpy(dst + copied, f.current.data + f.pos, chunk);
+                f.pos += chunk;
+                copied += chunk;
+        }
+        return copied;
+}
+
+static void write_bytes(sequential_file &f, const uint8_t *src, size_t n)
+{
+        while (n > 0) {
+                if (!f.has_current || f.pos == SEQ_BUFFER_SIZE) {
+                        next_output_buffer(f);
+                }
+                const size_t chunk = min(n, SEQ_BUFFER_SIZE - f.pos);
+                memcpy(f.current.data + f.pos, src, chunk);
+                f.pos += chunk;
+                src += chunk;
+                n -= chunk;
+        }
+}
+
+static int open_file(sequential_file &f, const string &path, const string &mode)
+{
+        int flags;
+        if (mode == "INPUT") {
+                flags = O_RDONLY;
+        } else if (mode == "OUTPUT") {
+                flags = O_WRONLY | O_CREAT | O_TRUNC;
+                f.output = true;
+        } else if (mode == "EXTEND") {
+                flags = O_WRONLY | O_CREAT | O_APPEND;
+                f.output = true;
+        } else {
+                return FS_BAD_ATTRIBUTES;
+        }
+
+        f.fd = open(path.c_str(), flags | O_CLOEXEC, 0644);
+        if (f.fd < 0) {
+                return errno == ENOENT ? FS_NOT_FOUND_FILE : FS_IO_ERROR;
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (!f.output) {
+                posix_fadvise(f.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+#endif
+
+        for (int i = 0; i < SEQ_NUM_BUFFERS; ++i) {
+                void *p = nullptr;
+                if (posix_memalign(&p, SEQ_BUFFER_ALIGN, SEQ_BUFFER_SIZE) != 0) {
+                        return FS_IO_ERROR;
+                }
+                f.storage.emplace_back((uint8_t*)p, &free);
+                f.free_buffers.push_back(io_buffer{(uint8_t*)p, 0});
+        }
+
+        if (f.output) {
+                f.worker = thread(&write_behind, &f);
+        } else {
+                f.worker = thread(&read_ahead, &f);
+        }
+        return FS_SUCCESS;
+}
+
+// Flushes pending output and stops the thread, returns the status of the
+// deferred writes.
+static int close_file(sequential_file &f)
+{
+        if (f.worker.joinable()) {
+                if (f.output && f.has_current && f.pos > 0) {
+                        lock_guard<mutex> lock(f.m);
+                        f.current.length = f.pos;
+                        f.full_buffers.push_back(f.current);
+                        f.has_current = false;
+                }
+                {
+                        lock_guard<mutex> lock(f.m);
+                        f.stop = true;
+                        f.cv.notify_all();
+                }
+                f.worker.join();
+        }
+
+        int status = f.error ? FS_IO_ERROR : FS_SUCCESS;
+        if (f.fd >= 0 && close(f.fd) != 0 && f.output) {
+                status = FS_IO_ERROR;
+        }
+        f.fd = -1;
+        return status;
+}
+
+sequential_file::~sequential_file()
+{
+        close_file(*this);
+}
+
+// Reads the next record straight into the Display slot `slot`, which is
+// left as it was at end of file but not after an I/O error.
+static int read_record(sequential_file &f, struct cam_s *cam, int slot)
+{
+        size_t length = f.record_length;
+        if (f.variable) {
+                uint8_t rdw[RDW_LENGTH];
+                const size_t n = read_bytes(f, rdw, RDW_LENGTH);
+                if (n == 0) {
+                        return f.error ? FS_IO_ERROR : FS_END_OF_FILE;
+                }
+                length = ((size_t)rdw[0] << 8) | rdw[1];
+                if (n != RDW_LENGTH || length < RDW_LENGTH) {
+                        return FS_IO_ERROR;
+                }
+                length -= RDW_LENGTH;
+        } else if (!input_left(f)) {
+                return f.error ? FS_IO_ERROR : FS_END_OF_FILE;
+        }
+
+        char *record = cam_set_slot_display(cam, slot, nullptr, (int)length);
+        if (read_bytes(f, (uint8_t*)record, length) != length) {
+                return FS_IO_ERROR;
+        }
+        return FS_SUCCESS;
+}
+
+static int write_record(sequential_file &f, const char *record, size_t length)
+{
+        {
+                lock_guard<mutex> lock(f.m);
+                if (f.error) {
+                        return FS_IO_ERROR;
+                }
+        }
+
+        if (f.variable) {
+                length = min(length, (size_t)f.record_length);
+                const size_t total = length + RDW_LENGTH;
+                const uint8_t rdw[RDW_LENGTH] = {(uint8_t)(total >> 8), (uint8_t)total, 0, 0};
+                write_bytes(f, rdw, RDW_LENGTH);
+                write_bytes(f, (const uint8_t*)record, length);
+                return FS_SUCCESS;
+        }
+
+        uint8_t spaces[256];
+        memset(spaces, ' ', sizeof(spaces));
+        length = min(length, (size_t)f.record_length);
+        write_bytes(f, (const uint8_t*)record, length);
+        for (size_t pad = f.record_length - length; pad > 0; ) {
+                const size_t n = min(pad, sizeof(spaces));
+                write_bytes(f, spaces, n);
+                pad -= n;
+        }
+        return FS_SUCCESS;
+}
+
+// Handles are per instance, the table is only locked to look one up so
+// that a read or write waiting on its thread doesn't hold up the others.
+struct sequential_files
+{
+        mutex m;
+        vector<shared_ptr<sequential_file>> files;
+};
+
+sequential_files* sequential_files_new()
+{
+        return new sequential_files();
+}
+
+// the files still open are flushed and their threads joined
+void sequential_files_drop(sequential_files *files)
+{
+        delete files;
+}
+
+static shared_ptr<sequential_file> get_file(sequential_files *t, int64_t handle)
+{
+        lock_guard<mutex> lock(t->m);
+        if (handle < 1 || handle > (int64_t)t->files.size()) {
+                return nullptr;
+        }
+        return t->files[handle - 1];
+}
+
+static string get_slot_string(struct cam_s *cam, int slot)
+{
+        int length;
+        const char *str = cam_get_slot_display(cam, slot, &length);
+        string s(str, length);
+        s.erase(s.find_last_not_of(' ') + 1);
+        return s;
+}
+
+static void set_status(struct cam_s *cam, int status)
+{
+        cam_set_slot_comp_4(cam, -1, false, 0, status);
+}
+
+// CALL 'SYSTEM:SEQ-OPEN' USING path mode record-format record-length
+//                              handle file-status
+// where `mode` is INPUT, OUTPUT or EXTEND and `record-format` is F or V,
+// `record-length` being the maximum length for V.
+static void seq_open(struct cam_s *cam, int num_usings, void *ud)
+{
+        if (num_usings != 6) {
+                return;
+        }
+
+        const string path   = get_slot_string(cam, -6);
+        const string mode   = get_slot_string(cam, -5);
+        const string format = get_slot_string(cam, -4);
+        const int64_t record_length = get_slot_integer(cam, -3);
+
+        if ((format != "F" && format != "V") || record_length <= 0 ||
+            (format == "V" && record_length > (int64_t)MAX_VARIABLE_RECORD)) {
+                set_status(cam, FS_BAD_ATTRIBUTES);
+                return;
+        }
+
+        shared_ptr<sequential_file> f = make_shared<sequential_file>();
+        f->variable = format == "V";
+        f->record_length = (uint32_t)record_length;
+
+        int status = open_file(*f, path, mode);
+        if (status == FS_SUCCESS) {
+                sequential_files *t = (sequential_files*)ud;
+                lock_guard<mutex> lock(t->m);
+                t->files.push_back(f);
+                cam_set_slot_comp_4(cam, -2, false, 0, (cam_comp_4_t)t->files.size());
+        } else {
+                close_file(*f);
+        }
+        set_status(cam, status);
+}
+
+// CALL 'SYSTEM:SEQ-CLOSE' USING handle file-status
+static void seq_close(struct cam_s *cam, int num_usings, void *ud)
+{
+        if (num_usings != 2) {
+                return;
+        }
+
+        sequential_files *t = (sequential_files*)ud;
+        const int64_t handle = get_slot_integer(cam, -2);
+        shared_ptr<sequential_file> f;
+        {
+                lock_guard<mutex> lock(t->m);
+                if (handle >= 1 && handle <= (int64_t)t->files.size()) {
+                        f.swap(t->files[handle - 1]);
+                }
+        }
+        if (!f) {
+                set_status(cam, FS_NOT_OPEN);
+                return;
+        }
+
+        lock_guard<mutex> lock(f->op_lock);
+        set_status(cam, close_file(*f));
+}
+
+// CALL 'SYSTEM:SEQ-READ' USING handle record file-status
+static void seq_read(struct cam_s *cam, int num_usings, void *ud)
+{
+        if (num_usings != 3) {
+                return;
+        }
+
+        shared_ptr<sequential_file> f = get_file((sequential_files*)ud, get_slot_integer(cam, -3));
+        if (!f) {
+                set_status(cam, FS_NOT_OPEN);
+                return;
+        }
+        lock_guard<mutex> lock(f->op_lock);
+        if (f->fd < 0) {
+                set_status(cam, FS_NOT_OPEN);
+                return;
+        }
+        if (f->output) {
+                set_status(cam, FS_WRONG_MODE);
+                return;
+        }
+
+        set_status(cam, read_record(*f, cam, -2));
+}
+
+// CALL 'SYSTEM:SEQ-WRITE' USING handle record file-status, fixed length
+// records are padded with spaces or truncated.
+static void seq_write(struct cam_s *cam, int num_usings, void *ud)
+{
+        if (num_usings != 3) {
+                return;
+        }
+
+        shared_ptr<sequential_file> f = get_file((sequential_files*)ud, get_slot_integer(cam, -3));
+        if (!f) {
+                set_status(cam, FS_NOT_OPEN);
+                return;
+        }
+        lock_guard<mutex> lock(f->op_lock);
+        if (f->fd < 0) {
+                set_status(cam, FS_NOT_OPEN);
+                return;
+        }
+        if (!f->output) {
+                set_status(cam, FS_WRONG_MODE);
+                return;
+        }
+
+        int length;
+        const char *str = cam_get_slot_display(cam, -2, &length);
+        set_status(cam, write_record(*f, str, length));
+}
+
+static char open_name[]     = "SEQ-OPEN";
+static char close_name[]    = "SEQ-CLOSE";
+static char read_name[]     = "SEQ-READ";
+static char write_name[]    = "SEQ-WRITE";
+
+void SequentialFilePrograms(vector<cam_foreign_program_t> &programs, sequential_files *files)
+{
+        add_program(programs, open_name,  &seq_open,  files);
+        add_program(programs, close_name, &seq_close, files);
+        add_program(programs, read_name,  &seq_read,  files);
+        add_program(programs, write_name, &seq_write, files);
+}
+
+} } // namespace cam::native
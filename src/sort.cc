@@ -0,0 +1,578 @@
+#include "native_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace cam { namespace native {
+
+// DFSORT return codes
+static const int RC_SUCCESS = 0;
+static const int RC_FAILURE = 16;
+
+static const size_t DEFAULT_MEMORY_MB = 256;
+static const size_t MIN_READ_BUFFER = 64 * 1024;
+
+enum key_format
+{
+        KEY_CH, // bytes, also BI
+        KEY_FI, // signed big-endian binary
+        KEY_ZD, // zoned decimal
+        KEY_PD  // packed decimal
+};
+
+struct sort_key
+{
+        int offset;
+        int length;
+        key_format format;
+        bool descending;
+};
+
+struct sort_spec
+{
+        int record_length;
+        vector<sort_key> keys;
+};
+
+static string get_slot_string(struct cam_s *cam, int slot)
+{
+        int length;
+        const char *str = cam_get_slot_display(cam, slot, &length);
+        return string(str, length);
+}
+
+static string trim(const string &s)
+{
+        const size_t b = s.find_first_not_of(' ');
+        if (b == string::npos) {
+                return string();
+        }
+        const size_t e = s.find_last_not_of(' ');
+        return s.substr(b, e - b + 1);
+}
+
+static vector<string> split(const string &s, char sep)
+{
+        vector<string> parts;
+        size_t b = 0;
+        for (;;) {
+                const size_t e = s.find(sep, b);
+                parts.push_back(trim(s.substr(b, e == string::npos ? string::npos : e - b)));
+                if (e == string::npos) {
+                        return parts;
+                }
+                b = e + 1;
+        }
+}
+
+// Parses DFSORT style fields, e.g. "1,10,CH,A,21,4,PD,D", positions are
+// 1-based as in the control statements.
+static bool parse_keys(const string &fields, int record_length, vector<sort_key> &keys)
+{
+        const vector<string> parts = split(fields, ',');
+        if (parts.size() % 4 != 0 || parts.empty()) {
+                return false;
+        }
+
+        for (size_t i = 0; i < parts.size(); i += 4) {
+                sort_key k;
+                k.offset = atoi(parts[i].c_str()) - 1;
+                k.length = atoi(parts[i + 1].c_str());
+                if (k.offset < 0 || k.length <= 0 || k.offset + k.length > record_length) {
+                        return false;
+                }
+
+                const string &f = parts[i + 2];
+                if (f == "CH" || f == "BI") {
+                        k.format = KEY_CH;
+                } else if (f == "FI" && k.length <= 8) {
+                        k.format = KEY_FI;
+                } else if (f == "ZD" && k.length <= 18) {
+                        k.format = KEY_ZD;
+                } else if (f == "PD" && k.length <= 10) {
+                        k.format = KEY_PD;
+                } else {
+                        return false;
+                }
+
+                if (parts[i + 3] == "A") {
+                        k.descending = false;
+                } else if (parts[i + 3] == "D") {
+                        k.descending = true;
+                } else {
+                        return false;
+                }
+
+                keys.push_back(k);
+        }
+
+        return true;
+}
+
+// False if a ZD or PD key of `record` has a bad digit or sign, such a
+// record fails the sort instead of comparing as zero.
+static bool valid_keys(const sort_spec &spec, const uint8_t *record)
+{
+        for (size_t i = 0; i < spec.keys.size(); ++i) {
+                const sort_key &k = spec.keys[i];
+                const uint8_t *p = record + k.offset;
+                if (k.format == KEY_ZD) {
+                        for (int j = 0; j < k.length; ++j) {
+                                if ((p[j] & 0x0F) > 9) {
+                                        return false;
+                                }
+                        }
+                } else if (k.format == KEY_PD) {
+                        bool is_signed;
+                        cam_comp_4_t v;
+                        if (!comp3_unpack(p, k.length, &is_signed, &v)) {
+                                return false;
+                        }
+                }
+        }
+        return true;
+}
+
+// Keys must have passed `valid_keys`.
+static int64_t key_number(const sort_key &k, const uint8_t *p)
+{
+        switch (k.format) {
+        case KEY_FI: {
+                uint64_t v = 0;
+                for (int i = 0; i < k.length; ++i) {
+                        v = (v << 8) | p[i];
+                }
+                if (k.length < 8 && (p[0] & 0x80)) {
+                        v |= ~0ULL << (k.length * 8);
+                }
+                return (int64_t)v; }
+        case KEY_ZD: {
+                int64_t v = 0;
+                for (int i = 0; i < k.length; ++i) {
+                        v = v * 10 + (p[i] & 0x0F);
+                }
+                const int zone = p[k.length - 1] & 0xF0;
+                return (zone == 0xD0 || zone == 0xB0 || zone == 0x70) ? -v : v; }
+        default: {
+                bool is_signed;
+                cam_comp_4_t v = 0;
+                comp3_unpack(p, k.length, &is_signed, &v);
+                return v; }
+        }
+}
+
+static int compare_records(const sort_spec &spec, const uint8_t *a, const uint8_t *b)
+{
+        for (size_t i = 0; i < spec.keys.size(); ++i) {
+                const sort_key &k = spec.keys[i];
+                int r;
+                if (k.format == KEY_CH) {
+                        r = memcmp(a + k.offset, b + k.offset, k.length);
+                } else {
+                        const int64_t x = key_number(k, a + k.offset), y = key_number(k, b + k.offset);
+                        r = (x > y) - (x < y);
+                }
+                if (r != 0) {
+                        return k.descending ? -r : r;
+                }
+        }
+        return 0;
+}
+
+struct file_closer
+{
+        void operator()(FILE *f) const { if (f) fclose(f); }
+};
+
+typedef unique_ptr<FILE, file_closer> file_ptr;
+
+// Sorts the records of `buf` in place, stable. False, leaving `buf` as it
+// was, if a record has a malformed key.
+static bool sort_block(const sort_spec &spec, uint8_t *buf, size_t num_records)
+{
+        const int len = spec.record_length;
+
+        for (size_t i = 0; i < num_records; ++i) {
+                if (!valid_keys(spec, buf + i * len)) {
+                        return false;
+                }
+        }
+
+        vector<uint32_t> order(num_records);
+        for (size_t i = 0; i < num_records; ++i) {
+                order[i] = (uint32_t)i;
+        }
+        stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+                return compare_records(spec, buf + (size_t)x * len, buf + (size_t)y * len) < 0;
+        });
+
+        // apply the permutation in place, a cycle at a time through one
+        // spare record, marking placed records by pointing them at
+        // themselves
+        vector<uint8_t> spare(len);
+        for (size_t i = 0; i < num_records; ++i) {
+                if (order[i] == i) {
+                        continue;
+                }
+                memcpy(spare.data(), buf + i * len, len);
+                size_t dst = i;
+                for (;;) {
+                        const size_t src = order[dst];
+                        order[dst] = (uint32_t)dst;
+                        if (src == i) {
+                                break;
+                        }
+                        memcpy(buf + dst * len, buf + src * len, len);
+                        dst = src;
+                }
+                memcpy(buf + dst * len, spare.data(), len);
+        }
+        return true;
+}
+
+// Either a file read through `buf` or records already in memory (and
+// already checked).
+struct merge_source
+{
+        FILE *f;
+        vector<uint8_t> buf;
+        const uint8_t *data;
+        size_t pos;
+        size_t end;
+        // a trailing partial record or a malformed key was read
+        bool bad;
+};
+
+static merge_source memory_source(const uint8_t *data, size_t bytes)
+{
+        merge_source s;
+        s.f    = nullptr;
+        s.data = data;
+        s.pos  = 0;
+        s.end  = bytes;
+        s.bad  = false;
+        return s;
+}
+
+static vector<merge_source> file_sources(const sort_spec &spec, const vector<FILE*> &inputs, size_t memory)
+{
+        const int len = spec.record_length;
+        size_t per_source = memory / (inputs.size() + 1);
+        per_source = max(per_source, MIN_READ_BUFFER);
+        per_source = max(per_source - per_source % len, (size_t)len);
+
+        vector<merge_source> sources(inputs.size());
+        for (size_t i = 0; i < inputs.size(); ++i) {
+                sources[i].f = inputs[i];
+                sources[i].buf.resize(per_source);
+                sources[i].data = sources[i].buf.data();
+                sources[i].pos = sources[i].end = 0;
+                sources[i].bad = false;
+        }
+        return sources;
+}
+
+// The buffer holds whole records, so a short read that isn't a multiple
+// of the record length can only be a partial record at the end.
+static const uint8_t* merge_source_peek(const sort_spec &spec, merge_source &s)
+{
+        if (s.pos == s.end) {
+                if (!s.f) {
+                        return nullptr;
+                }
+                s.end = fread(s.buf.data(), 1, s.buf.size(), s.f);
+                s.pos = 0;
+                if (s.end % spec.record_length != 0) {
+                        s.bad = true;
+                        return nullptr;
+                }
+                if (s.end == 0) {
+                        return nullptr;
+                }
+        }
+        if (s.f && !valid_keys(spec, s.data + s.pos)) {
+                s.bad = true;
+                return nullptr;
+        }
+        return s.data + s.pos;
+}
+
+// k-way merge, ties go to the lower source so that merging runs is stable.
+static bool merge_sources(const sort_spec &spec, vector<merge_source> &sources, FILE *output)
+{
+        const int len = spec.record_length;
+
+        typedef pair<const uint8_t*, size_t> head;
+        auto later = [&](const head &x, const head &y) {
+                const int r = compare_records(spec, x.first, y.first);
+                return r > 0 || (r == 0 && x.second > y.second);
+        };
+        priority_queue<head, vector<head>, decltype(later)> heads(later);
+
+        for (size_t i = 0; i < sources.size(); ++i) {
+                const uint8_t *p = merge_source_peek(spec, sources[i]);
+                if (p) {
+                        heads.push(head(p, i));
+                }
+        }
+
+        while (!heads.empty()) {
+                const head h = heads.top();
+                heads.pop();
+                if (fwrite(h.first, len, 1, output) != 1) {
+                        return false;
+                }
+
+                merge_source &s = sources[h.second];
+                s.pos += len;
+                const uint8_t *p = merge_source_peek(spec, s);
+                if (p) {
+                        heads.push(head(p, h.second));
+                }
+        }
+
+        for (size_t i = 0; i < sources.size(); ++i) {
+                if (sources[i].bad || (sources[i].f && ferror(sources[i].f))) {
+                        return false;
+                }
+        }
+
+        return fflush(output) == 0;
+}
+
+static FILE* open_buffered(const char *path, const char *mode, size_t buffer)
+{
+        FILE *f = fopen(path, mode);
+        if (f) {
+                setvbuf(f, nullptr, _IOFBF, buffer);
+        }
+        return f;
+}
+
+// Most runs merged at once so that each still gets a MIN_READ_BUFFER read
+// buffer, plus one for the output, out of `memory`.
+static size_t merge_width(size_t memory)
+{
+        return max(memory / MIN_READ_BUFFER, (size_t)3) - 1;
+}
+
+// Merges `inputs` into `output`. If there are more of them than
+// `merge_width` allows, consecutive groups are first merged into temporary
+// runs, pass after pass, keeping the merge stable.
+static bool merge_files(const sort_spec &spec, vector<FILE*> inputs, FILE *output, size_t memory)
+{
+        const size_t width = merge_width(memory);
+
+        // the runs of the previous pass, closed once merged
+        vector<file_ptr> runs;
+        while (inputs.size() > width) {
+                vector<file_ptr> next;
+                vector<FILE*> next_inputs;
+                for (size_t b = 0; b < inputs.size(); b += width) {
+                        file_ptr run(tmpfile());
+                        if (!run) {
+                                return false;
+                        }
+                        const vector<FILE*> group(inputs.begin() + b, inputs.begin() + min(b + width, inputs.size()));
+                        vector<merge_source> sources = file_sources(spec, group, memory);
+                        if (!merge_sources(spec, sources, run.get())) {
+                                return false;
+                        }
+                        rewind(run.get());
+                        next_inputs.push_back(run.get());
+                        next.push_back(move(run));
+                }
+                runs = move(next);
+                inputs = move(next_inputs);
+        }
+
+        vector<merge_source> sources = file_sources(spec, inputs, memory);
+        return merge_sources(spec, sources, output);
+}
+
+// Run generation: fill the memory budget, sort one slice of it per thread
+// and merge the slices into a run, then merge the runs into `output`.
+static bool sort_file(const sort_spec &spec, const string &input, const string &output, size_t memory)
+{
+        const int len = spec.record_length;
+
+        file_ptr in(open_buffered(input.c_str(), "rb", MIN_READ_BUFFER));
+        if (!in) {
+                return false;
+        }
+
+        // each record in the block costs its bytes and a sort_block order
+        // entry
+        const size_t capacity = max(memory / (len + sizeof(uint32_t)), (size_t)1);
+        vector<uint8_t> block(capacity * len);
+        const int num_threads = max((int)thread::hardware_concurrency(), 1);
+
+        vector<file_ptr> runs;
+        for (;;) {
+                // read bytes rather than records, fread would silently
+                // drop a trailing partial record
+                const size_t bytes = fread(block.data(), 1, block.size(), in.get());
+                if (ferror(in.get()) || bytes % len != 0) {
+                        return false;
+                }
+                const size_t n = bytes / len;
+                if (n == 0 && !runs.empty()) {
+                        break;
+                }
+
+                const size_t per_thread = (n + num_threads - 1) / num_threads;
+                vector<thread> workers;
+                vector<pair<size_t, size_t>> slices;
+                vector<char> sorted(num_threads);
+                for (size_t b = 0; b < n; b += per_thread) {
+                        const size_t count = min(per_thread, n - b);
+                        char *ok = &sorted[slices.size()];
+                        slices.push_back(make_pair(b, count));
+                        workers.push_back(thread([&spec, &block, ok, b, count, len]() {
+                                *ok = sort_block(spec, &block[b * len], count);
+                        }));
+                }
+                for (size_t i = 0; i < workers.size(); ++i) {
+                        workers[i].join();
+                }
+                for (size_t i = 0; i < slices.size(); ++i) {
+                        if (!sorted[i]) {
+                                return false;
+                        }
+                }
+
+                vector<merge_source> sources;
+                for (size_t i = 0; i < slices.size(); ++i) {
+                        sources.push_back(memory_source(&block[slices[i].first * len], slices[i].second * len));
+                }
+
+                // everything fit in memory, merge the slices straight out
+                if (runs.empty() && n < capacity) {
+                        file_ptr out(open_buffered(output.c_str(), "wb", MIN_READ_BUFFER));
+                        return out && merge_sources(spec, sources, out.get());
+                }
+
+                file_ptr run(tmpfile());
+                if (!run || !merge_sources(spec, sources, run.get())) {
+                        return false;
+                }
+                rewind(run.get());
+                runs.push_back(move(run));
+
+                if (n < capacity) {
+                        break;
+                }
+        }
+
+        // release the run buffer before merging
+        vector<uint8_t>().swap(block);
+
+        file_ptr out(open_buffered(output.c_str(), "wb", MIN_READ_BUFFER));
+        if (!out) {
+                return false;
+        }
+
+        vector<FILE*> inputs;
+        for (size_t i = 0; i < runs.size(); ++i) {
+                inputs.push_back(runs[i].get());
+        }
+        return merge_files(spec, inputs, out.get(), memory);
+}
+
+static size_t memory_budget(struct cam_s *cam, int num_usings)
+{
+        size_t mb = DEFAULT_MEMORY_MB;
+        if (num_usings == 6) {
+                const int64_t v = get_slot_integer(cam, -2);
+                if (v > 0) {
+                        mb = (size_t)v;
+                }
+        }
+        return mb * 1024 * 1024;
+}
+
+static bool parse_spec(struct cam_s *cam, int num_usings, sort_spec &spec)
+{
+        spec.record_length = (int)get_slot_integer(cam, 2 - num_usings);
+        return spec.record_length > 0
+            && parse_keys(get_slot_string(cam, 3 - num_usings), spec.record_length, spec.keys);
+}
+
+// CALL 'SYSTEM:SORT' USING input output record-length fields
+//                          [memory-mb] return-code
+static void sort_program(struct cam_s *cam, int num_usings, void *)
+{
+        if (num_usings != 5 && num_usings != 6) {
+                return;
+        }
+
+        sort_spec spec;
+        int rc = RC_FAILURE;
+        if (parse_spec(cam, num_usings, spec)) {
+                const string input  = trim(get_slot_string(cam, -num_usings));
+                const string output = trim(get_slot_string(cam, 1 - num_usings));
+                if (sort_file(spec, input, output, memory_budget(cam, num_usings))) {
+                        rc = RC_SUCCESS;
+                }
+        }
+
+        cam_set_slot_comp_4(cam, -1, true, 0, rc);
+}
+
+// CALL 'SYSTEM:MERGE' USING inputs output record-length fields
+//                           [memory-mb] return-code
+// where `inputs` is a comma separated list of already sorted files.
+static void merge_program(struct cam_s *cam, int num_usings, void *)
+{
+        if (num_usings != 5 && num_usings != 6) {
+                return;
+        }
+
+        sort_spec spec;
+        int rc = RC_FAILURE;
+        if (parse_spec(cam, num_usings, spec)) {
+                const size_t memory = memory_budget(cam, num_usings);
+                const vector<string> paths = split(get_slot_string(cam, -num_usings), ',');
+
+                vector<file_ptr> files;
+                vector<FILE*> inputs;
+                bool opened = true;
+                for (size_t i = 0; i < paths.size() && opened; ++i) {
+                        files.push_back(file_ptr(fopen(paths[i].c_str(), "rb")));
+                        opened = files.back() != nullptr;
+                        inputs.push_back(files.back().get());
+                }
+
+                const string output = trim(get_slot_string(cam, 1 - num_usings));
+                file_ptr out(opened ? open_buffered(output.c_str(), "wb", MIN_READ_BUFFER) : nullptr);
+                if (out) {
+                        if (merge_files(spec, inputs, out.get(), memory)) {
+                                rc = RC_SUCCESS;
+                        }
+                }
+        }
+
+        cam_set_slot_comp_4(cam, -1, true, 0, rc);
+}
+
+static char sort_name[]     = "SORT";
+static char merge_name[]    = "MERGE";
+
+void SortPrograms(vector<cam_foreign_program_t> &programs)
+{
+        add_program(programs, sort_name,  &sort_program);
+        add_program(programs, merge_name, &merge_program);
+}
+
+} } // namespace cam::native
@@ -0,0 +1,138 @@
+import { Transform, TransformCallback, TransformOptions } from 'stream'
+import { CamNative } from './cam'
+import { RecordCodec, RecordLayout } from './record'
+import { ErrorCode } from './error'
+
+export interface RecordTransformOptions extends TransformOptions
+{
+        program: [string, string]
+        input: RecordLayout
+        output: RecordLayout
+        // records per native call
+        batchRecords?: number
+}
+
+// Whole records of a chunk still to run, `data` is a view into the chunk.
+interface Segment
+{
+        data: Buffer
+        first: number
+        end: number
+}
+
+// Feeds fixed-width records through a program, the usings are decoded from
+// each input record and the returnings are encoded into an output record.
+// Work stops at the batch where push() reports a full readable buffer and
+// resumes on the next read, so memory is bounded by the high water marks
+// plus one batch of output.
+export class RecordTransform extends Transform
+{
+        private cam: CamNative
+        private program: [string, string]
+        private input: RecordCodec
+        private output: RecordCodec
+        private batchRecords: number
+        private processed = 0
+        // a record split across chunks, only its bytes are copied
+        private carry: Buffer
+        private carryLength = 0
+        private segments: Segment[] = []
+        private callback?: TransformCallback
+
+        constructor(cam: CamNative, options: RecordTransformOptions)
+        {
+                super(options)
+                this.cam          = cam
+                this.program      = options.program
+                this.input        = new RecordCodec(options.input)
+                this.output       = new RecordCodec(options.output)
+                this.batchRecords = options.batchRecords || 1024
+                this.carry        = Buffer.allocUnsafe(options.input.recordLength)
+        }
+
+        _transform(chunk: Buffer, _encoding: string, callback: TransformCallback): void
+        {
+                const recordLength = this.input.layout.recordLength
+
+                let offset = 0
+                if (this.carryLength > 0) {
+                        offset = Math.min(recordLength - this.carryLength, chunk.length)
+                        chunk.copy(this.carry, this.carryLength, 0, offset)
+                        this.carryLength += offset
+                        if (this.carryLength === recordLength) {
+                                this.segments.push({ data: this.carry, first: 0, end: 1 })
+                                this.carry = Buffer.allocUnsafe(recordLength)
+                                this.carryLength = 0
+                        }
+                }
+
+                const data = chunk.slice(offset)
+                const numRecords = Math.floor(data.length / recordLength)
+                if (numRecords > 0) {
+                        this.segments.push({ data, first: 0, end: numRecords })
+                }
+
+                const rest = data.length - numRecords * recordLength
+                if (rest > 0) {
+                        data.copy(this.carry, 0, data.length - rest)
+                        this.carryLength = rest
+                }
+
+                this.callback = callback
+                this.drain()
+        }
+
+        _read(size: number): void
+        {
+                if (this.segments.length > 0) {
+                        this.drain()
+                } else {
+                        super._read(size)
+                }
+        }
+
+        _flush(callback: TransformCallback): void
+        {
+                if (this.carryLength > 0) {
+                        callback(new Error('trailing partial record of ' + this.carryLength + ' bytes'))
+                } else {
+                        callback()
+                }
+        }
+
+        // Runs the pending segments a batch at a time, the chunk's callback
+        // is only called once all of them ran.
+        private drain(): void
+        {
+                while (this.segments.length > 0) {
+                        const s = this.segments[0]
+                        const count = Math.min(this.batchRecords, s.end - s.first)
+                        const r = this.cam.runRecords(this.program, this.input, this.output, s.data, s.first, count)
+                        if (r.errorCode !== ErrorCode.Success) {
+                                this.segments = []
+                                this.done(new Error('failed at record ' + (this.processed + r.processed) + ': code = ' + r.errorCode))
+                                return
+                        }
+
+                        this.processed += count
+                        s.first += count
+                        if (s.first === s.end) {
+                                this.segments.shift()
+                        }
+                        if (!this.push(r.output) && this.segments.length > 0) {
+                                return
+                        }
+                }
+
+                this.done()
+        }
+
+        private done(err?: Error): void
+        {
+                const callback = this.callback
+                this.callback = undefined
+                if (callback) {
+                        callback(err)
+                }
+        }
+}